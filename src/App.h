@@ -1,12 +1,17 @@
 #pragma once
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <spawn.h>
 #include "Debase.h"
 #include "git/Git.h"
 #include "ui/Window.h"
 #include "ui/Screen.h"
 #include "ui/Color.h"
+#include "ui/RenderBackend.h"
 #include "ui/RevColumn.h"
 #include "ui/SnapshotButton.h"
 #include "ui/Menu.h"
@@ -19,8 +24,8 @@
 #include "state/Theme.h"
 #include "state/State.h"
 #include "git/Conflict.h"
+#include "git/CommitInfo.h"
 #include "lib/toastbox/String.h"
-#include "xterm-256color.h"
 #include "Terminal.h"
 #include "CurrentExecutablePath.h"
 #include "PathIsInEnvironmentPath.h"
@@ -36,8 +41,8 @@ extern "C" {
 
 class App : public UI::Screen {
 public:
-    App(Git::Repo repo, const std::vector<Rev>& revs) :
-    Screen(Uninit), _repo(repo), _revs(revs) {}
+    App(Git::Repo repo, const std::vector<Rev>& revs, UI::RenderBackendPtr backend) :
+    Screen(backend), _repo(repo), _revs(revs) {}
     
     // focusable(): override to affect cursor state
     bool focusable() const override { return true; }
@@ -126,6 +131,22 @@ public:
                     _trackSelectionRect(ev);
                 }
             
+            } else if (ev.mouse.bstate & (_ScrollUpButton|_ScrollDownButton)) {
+                const bool up = (ev.mouse.bstate & _ScrollUpButton);
+                // Shift+scroll scrolls the columns horizontally
+                if (ev.mouse.bstate & BUTTON_SHIFT) {
+                    _revScrollBy(up ? -1 : 1);
+                    break;
+                }
+                
+                const int delta = (up ? -_ScrollCommitCount : _ScrollCommitCount);
+                for (UI::RevColumnPtr col : _columns) {
+                    if (HitTest(col->frame(), ev.mouse.origin)) {
+                        _columnScroll(col, delta);
+                        break;
+                    }
+                }
+            
             } else if (ev.mouseDown(UI::Event::MouseButtons::Right)) {
                 if (hitTest) {
                     if (hitTest.nameField) {
@@ -140,10 +161,16 @@ public:
             break;
         }
         
+        case UI::Event::Type::KeyLeft:
+        case UI::Event::Type::KeyRight: {
+            _revScrollBy(ev.type==UI::Event::Type::KeyLeft ? -1 : 1);
+            break;
+        }
+        
         case UI::Event::Type::KeyDelete:
         case UI::Event::Type::KeyFnDelete: {
             if (!_selectionCanDelete()) {
-                beep();
+                backend().beep();
                 break;
             }
             
@@ -160,7 +187,7 @@ public:
         
         case UI::Event::Type::KeyB: {
             if (!_selectionCanBranch()) {
-                beep();
+                backend().beep();
                 break;
             }
             
@@ -173,7 +200,7 @@ public:
         
         case UI::Event::Type::KeyC: {
             if (!_selectionCanCombine()) {
-                beep();
+                backend().beep();
                 break;
             }
             
@@ -190,7 +217,7 @@ public:
         
         case UI::Event::Type::KeyReturn: {
             if (!_selectionCanEdit()) {
-                beep();
+                backend().beep();
                 break;
             }
             
@@ -213,11 +240,11 @@ public:
     
     void _runNoRepo() {
         try {
-            _cursesInit();
-            Defer(_cursesDeinit());
+            _renderInit();
+            Defer(_renderDeinit());
             
-            // Create our window now that ncurses is initialized
-            Window::operator =(Window(::stdscr));
+            // Create our window now that the backend is initialized
+            Window::operator =(Window(backend().surfaceScreen()));
             
             _reload();
             _moveOffer();
@@ -245,23 +272,22 @@ public:
         _head = _repo.headResolved();
         
         // Create _repoState
-        std::set<Git::Ref> refs;
-        for (const Rev& rev : _revs) {
-            if (rev.ref) refs.insert(rev.ref);
-        }
-        _repoState = State::RepoState(StateDir(), _repo, refs);
+        // Refs' states are loaded as their columns are scrolled into view
+        _repoState = State::RepoState(StateDir(), _repo);
+        _rewriteCache = std::make_unique<Git::RewriteCache>(_repoState.rewriteCachePath());
+        
+        // Display commits seen by previous sessions without reading the object database,
+        // and remember the commits that this session displays
+        Git::CommitInfoArena& commitInfos = Git::CommitInfoArena::ForRepo(_repo);
+        commitInfos.cacheOpen(_repoState.commitInfoCachePath());
+        Defer(commitInfos.cacheWrite());
         
         // If the repo has outstanding changes, prevent the currently checked-out
         // branch from being modified, since we can't clobber the uncommitted
-        // changes. We do this by marking all refs that match HEAD's ref as
-        // immutable.
-        if (_repo.dirty() && _head.ref) {
-            for (Rev& rev : _revs) {
-                if (rev.ref && rev.ref==_head.ref) {
-                    rev.mutability = Rev::Mutability::DisallowedUncommittedChanges;
-                }
-            }
-        }
+        // changes. Checking for changes can take a while in large working trees,
+        // so it happens in the background; see _dirtyCheckUpdate().
+        if (_head.ref) _dirtyCheckStart();
+        Defer(_dirtyCheckCancel());
         
         // Reattach head upon return
         // We do this via Defer() so that it executes even if there's an exception
@@ -273,8 +299,12 @@ public:
                 // Restore previous head on exit
                 std::cout << "Restoring HEAD to " << _head.ref.name() << std::endl;
                 std::string err;
+                bool submodules = false;
                 try {
-                    _repo.headAttach(_head);
+                    _repo.headAttach(_head, [&] (size_t done, size_t total) {
+                        std::cout << "\rUpdating submodules (" << done << "/" << total << ")" << std::flush;
+                        submodules = true;
+                    });
                 } catch (const Git::ConflictError& e) {
                     err = "Error: checkout failed because these untracked files would be overwritten:\n";
                     for (const _Path& path : e.paths) {
@@ -289,16 +319,17 @@ public:
                     err = std::string("Error: ") + e.what();
                 }
                 
+                if (submodules) std::cout << "\n";
                 std::cout << (!err.empty() ? err : "Done") << std::endl;
             }
         );
         
         try {
-            _cursesInit();
-            Defer(_cursesDeinit());
+            _renderInit();
+            Defer(_renderDeinit());
             
-            // Create our window now that ncurses is initialized
-            Window::operator =(Window(::stdscr));
+            // Create our window now that the backend is initialized
+            Window::operator =(Window(backend().surfaceScreen()));
             
             _reload();
             _moveOffer();
@@ -318,6 +349,15 @@ public:
             std::string errorMsg;
             
             try {
+                // While the dirty check is running, periodically wake up to apply its result
+                // We only do so when tracking from the top level, because applying the result
+                // reloads our columns.
+                if (deadline==Forever && _dirtyCheck.thread.joinable()) {
+                    Screen::track(std::chrono::steady_clock::now()+_DirtyCheckPollInterval);
+                    _dirtyCheckUpdate(false);
+                    continue;
+                }
+                
                 Screen::track(deadline);
                 break; // Deadline passed; break out of loop
             
@@ -433,24 +473,34 @@ private:
     static constexpr int _ColumnSpacing = 6;
     
     static constexpr int _SnapshotMenuWidth = 26;
+    static constexpr auto _GitOpProgressDelay = std::chrono::milliseconds(250);
+    static constexpr auto _GitOpProgressInterval = std::chrono::milliseconds(100);
+    static constexpr auto _DirtyCheckPollInterval = std::chrono::milliseconds(50);
     static constexpr auto _DoubleClickThresh = std::chrono::milliseconds(300);
     static constexpr mmask_t _SelectionShiftKeys = BUTTON_CTRL | BUTTON_SHIFT;
+    static constexpr mmask_t _ScrollUpButton = BUTTON4_PRESSED;
+    static constexpr mmask_t _ScrollDownButton = BUTTON5_PRESSED;
+    static constexpr int _ScrollCommitCount = 3;
     
     static Git::Commit _FindLatestCommit(Git::Commit head, const std::set<Git::Commit>& commits) {
-        while (head) {
-            if (commits.find(head) != commits.end()) return head;
-            head = head.parent();
+        if (!head) abort();
+        Git::Ancestry& ancestry = Git::Ancestry::ForCommit(head);
+        std::map<Git::Ancestry::Pos,Git::Commit> positions;
+        for (const Git::Commit& c : commits) positions[ancestry.pos(c)] = c;
+        for (Git::Ancestry::Pos p=ancestry.pos(head); p!=Git::Ancestry::PosNull; p=ancestry.parent(p)) {
+            auto it = positions.find(p);
+            if (it != positions.end()) return it->second;
         }
         // Programmer error if it doesn't exist
         abort();
     }
     
-    static UI::ColorPalette _ColorsCreate(State::Theme theme) {
+    static UI::ColorPalette _ColorsCreate(UI::RenderBackend& backend, State::Theme theme) {
         const char* termProgEnv = getenv("TERM_PROGRAM");
         const std::string termProg = termProgEnv ? termProgEnv : "";
         const bool themeDark = (theme==State::Theme::None || theme == State::Theme::Dark);
         
-        UI::ColorPalette colors;
+        UI::ColorPalette colors(backend);
         if (termProg == "Apple_Terminal") {
             // Colorspace: unknown
             // There's no simple relation between these numbers and the resulting colors because the macOS
@@ -520,8 +570,8 @@ private:
         return colors;
     }
     
-    static UI::ColorPalette _ColorsCreateDefault() {
-        UI::ColorPalette colors;
+    static UI::ColorPalette _ColorsCreateDefault(UI::RenderBackend& backend) {
+        UI::ColorPalette colors(backend);
         colors.normal           = UI::Color();
         colors.dimmed           = UI::Color();
         colors.selection        = colors.pairNew(COLOR_BLUE);
@@ -533,7 +583,7 @@ private:
     }
     
     _SelectState _selectStateGet(UI::RevColumnPtr col, UI::CommitPanelPtr panel) {
-        bool similar = _selection.commits.find(panel->commit()) != _selection.commits.end();
+        bool similar = _selection.commits.find(panel->commit().id) != _selection.commits.end();
         if (!similar) return _SelectState::False;
         return (col->rev()==_selection.rev ? _SelectState::True : _SelectState::Similar);
     }
@@ -617,20 +667,12 @@ private:
 //        abort();
     }
     
-    UI::CommitPanelPtr _panelForCommit(UI::RevColumnPtr col, Git::Commit commit) {
-        for (UI::CommitPanelPtr panel : col->panels()) {
-            if (panel->commit() == commit) return panel;
-        }
-        // Programmer error if it doesn't exist
-        abort();
-    }
-    
     UI::ButtonPtr _makeSnapshotMenuButton(const Git::Ref& ref, const State::Snapshot& snap,
         bool sessionStart, UI::SnapshotButton*& chosen) {
         
         const State::History& h = _repoState.history(ref);
         const bool activeSnapshot = h.get().refState == snap.refState;
-        const UI::SnapshotButtonPtr b = std::make_shared<UI::SnapshotButton>(_repo, snap, _SnapshotMenuWidth);
+        const UI::SnapshotButtonPtr b = UI::View::Create<UI::SnapshotButton>(_repo, snap, _SnapshotMenuWidth);
         b->activeSnapshot(activeSnapshot);
         b->action([&] (UI::Button& button) { chosen = (UI::SnapshotButton*)&button; });
         return b;
@@ -638,7 +680,7 @@ private:
     
     UI::ButtonPtr _makeContextMenuButton(std::string_view label, std::string_view key, bool enabled, UI::Button*& chosen) {
         constexpr int ContextMenuWidth = 12;
-        UI::ButtonPtr b = std::make_shared<UI::Button>();
+        UI::ButtonPtr b = UI::View::Create<UI::Button>();
         b->label()->text(label);
         b->label()->align(UI::Align::Left);
         b->key()->text(key);
@@ -781,30 +823,46 @@ private:
             _head = _repo.revReload(_head);
         }
         
-        // Reload all ref-based revs
-        for (Rev& rev : _revs) {
-            (Git::Rev&)rev = _repo.revReload(rev);
-        }
-        
-        // Create columns
+        // Create columns for the visible revs, starting at `_revScroll`
+        // Only the visible revs are reloaded; revs that are scrolled out of view
+        // are reloaded once they're scrolled back into view
+        _revScroll = std::min(_revScroll, _revScrollMax());
+        std::vector<UI::RevColumnPtr> columns;
         std::list<UI::ViewPtr> sv;
         int offX = _ColumnInsetX;
-        size_t colCount = 0;
-        for (const Rev& rev : _revs) {
-            State::History* h = (rev.ref ? &_repoState.history(rev.ref) : nullptr);
+        for (size_t i=_revScroll; i<_revs.size(); i++) {
             const int rem = size().x-offX;
             if (rem < _ColumnWidth) break;
             
-            // Create the column if it doesn't exist yet
-            bool create = (colCount >= _columns.size());
+            Rev& rev = _revs[i];
+            (Git::Rev&)rev = _repo.revReload(rev);
+            State::History* h = (rev.ref ? &_repoState.history(rev.ref) : nullptr);
             
+            // Reuse the rev's existing column, so that the column's state (eg its
+            // scroll offset) follows the rev as its position changes
             UI::RevColumnPtr col;
-            if (create) {
-                col = std::make_shared<UI::RevColumn>();
-                _columns.push_back(col);
+            for (UI::RevColumnPtr c : _columns) {
+                if (_SameColumnRev(c->rev(), rev)) {
+                    col = c;
+                    break;
+                }
+            }
+            
+            // Create the column if it doesn't exist yet
+            if (!col) {
+                col = UI::View::Create<UI::RevColumn>();
                 
                 col->repo(_repo);
                 
+                // Restore the column's scroll offset if it was scrolled out of view earlier
+                for (auto it=_columnScrollOffsets.begin(); it!=_columnScrollOffsets.end(); it++) {
+                    if (_SameColumnRev(it->first, rev)) {
+                        col->scrollOffset(it->second);
+                        _columnScrollOffsets.erase(it);
+                        break;
+                    }
+                }
+                
                 std::weak_ptr<UI::RevColumn> weakCol = col;
                 col->undoButton()->action([=] (UI::Button&) {
                     auto col = weakCol.lock();
@@ -831,9 +889,6 @@ private:
                     auto col = weakCol.lock();
                     if (col) _revColumnNameUnfocus(col, reason);
                 });
-            
-            } else {
-                col = _columns[colCount];
             }
             
             col->rev(rev); // Ensure all columns' revs are up to date (since refs become stale if they're modified)
@@ -841,14 +896,19 @@ private:
             col->undoButton()->enabled(h && !h->begin());
             col->redoButton()->enabled(h && !h->end());
             col->reload({_ColumnWidth, size().y});
+            columns.push_back(col);
             sv.push_back(col);
             
             offX += _ColumnWidth+_ColumnSpacing;
-            colCount++;
         }
         
-        // Erase columns that aren't visible
-        _columns.erase(_columns.begin()+colCount, _columns.end());
+        // Columns that aren't visible are destroyed here, so remember their scroll offsets
+        // for when they're scrolled back into view
+        for (UI::RevColumnPtr col : _columns) {
+            if (std::find(columns.begin(), columns.end(), col) != columns.end()) continue;
+            if (col->scrollOffset()) _columnScrollOffsets.push_back({col->rev(), col->scrollOffset()});
+        }
+        _columns = columns;
         
         // Update subviews
         for (UI::PanelPtr panel : _panels) {
@@ -861,6 +921,56 @@ private:
         eraseNeeded(true);
     }
     
+    // _SameColumnRev(): returns whether `a` and `b` are the same column, even if the
+    // commit of their ref has changed
+    static bool _SameColumnRev(const Rev& a, const Rev& b) {
+        if (a.ref || b.ref) return a.ref==b.ref && a.skip==b.skip;
+        return a.commit == b.commit;
+    }
+    
+    size_t _revColumnCountMax() const {
+        const int width = size().x-_ColumnInsetX+_ColumnSpacing;
+        return std::max(1, width/(_ColumnWidth+_ColumnSpacing));
+    }
+    
+    size_t _revScrollMax() const {
+        const size_t count = _revColumnCountMax();
+        return (_revs.size()>count ? _revs.size()-count : 0);
+    }
+    
+    void _revScrollBy(int delta) {
+        const size_t x = (delta<0 ? _revScroll-std::min(_revScroll, (size_t)-delta) : _revScroll+delta);
+        const size_t scroll = std::min(x, _revScrollMax());
+        if (scroll == _revScroll) return;
+        _revScroll = scroll;
+        _reload();
+    }
+    
+    // _revScrollToVisible(): scrolls horizontally, if necessary, so that the rev at index
+    // `idx` of `_revs` is visible; _reload() must be called afterwards
+    void _revScrollToVisible(size_t idx) {
+        const size_t count = _revColumnCountMax();
+        if (idx < _revScroll) _revScroll = idx;
+        else if (idx >= _revScroll+count) _revScroll = idx-count+1;
+    }
+    
+    void _columnScroll(UI::RevColumnPtr col, int delta) {
+        if (!col->scrollBy(delta)) return;
+        col->reload({_ColumnWidth, size().y});
+        layoutNeeded(true);
+        damage(col->frame());
+    }
+    
+    // _insertionCommit(): returns the commit after which commits are inserted at `ipos`
+    Git::Commit _insertionCommit(const _InsertionPosition& ipos) {
+        const UI::CommitPanelVec& panels = ipos.col->panels();
+        if (ipos.iter != panels.end()) return _repo.commitLookup((*ipos.iter)->commit().id);
+        // Inserting below the last visible panel, whose parent may be scrolled out of view
+        if (panels.empty()) return nullptr;
+        const Git::CommitInfo& last = panels.back()->commit();
+        return (last.parentCount ? _repo.commitLookup(last.parents[0]) : nullptr);
+    }
+    
     // _trackMouseInsideCommitPanel
     // Handles clicking/dragging a set of CommitPanels
     std::optional<_GitOp> _trackMouseInsideCommitPanel(const UI::Event& mouseDownEvent, UI::RevColumnPtr mouseDownColumn, UI::CommitPanelPtr mouseDownPanel) {
@@ -878,19 +988,19 @@ private:
         if (_selection.commits.empty() || (_selection.rev != mouseDownColumn->rev()) || !wasSelected) {
             _selection = {
                 .rev = mouseDownColumn->rev(),
-                .commits = {mouseDownPanel->commit()},
+                .commits = {_repo.commitLookup(mouseDownPanel->commit().id)},
             };
         
         } else {
             assert(!_selection.commits.empty() && (_selection.rev == mouseDownColumn->rev()));
-            _selection.commits.insert(mouseDownPanel->commit());
+            _selection.commits.insert(_repo.commitLookup(mouseDownPanel->commit().id));
         }
         
         UI::RevColumnPtr selectionColumn = _columnForRev(_selection.rev);
         if (!selectionColumn) abort();
         
+        // The title commit may be scrolled out of view, so it doesn't necessarily have a panel
         Git::Commit titleCommit = _FindLatestCommit(_selection.rev.commit, _selection.commits);
-        UI::CommitPanelPtr titlePanel = _panelForCommit(selectionColumn, titleCommit);
         
         UI::Event ev = mouseDownEvent;
         std::optional<_InsertionPosition> ipos;
@@ -911,12 +1021,12 @@ private:
             ipos = _findInsertionPosition(p);
             
             if (!_drag.titlePanel && mouseDragged && allow) {
-                _drag.titlePanel = std::make_shared<UI::CommitPanel>();
-                _drag.titlePanel->commit(titleCommit);
+                _drag.titlePanel = UI::View::Create<UI::CommitPanel>();
+                _drag.titlePanel->commit(Git::CommitInfoArena::ForRepo(_repo).info(titleCommit.id()));
                 
                 // Create shadow panels
                 for (size_t i=0; i<_selection.commits.size()-1; i++) {
-                    _drag.shadowPanels.push_back(std::make_shared<UI::Panel>());
+                    _drag.shadowPanels.push_back(UI::View::Create<UI::Panel>());
                 }
                 
                 for (auto it=_drag.shadowPanels.rbegin(); it!=_drag.shadowPanels.rend(); it++) {
@@ -928,6 +1038,7 @@ private:
                 layoutNeeded(true);
             
             } else if (!allow) {
+                _insertionMarkerDamage();
                 _drag = {};
                 // The titlePanel/shadowPanels need layout
                 layoutNeeded(true);
@@ -952,7 +1063,7 @@ private:
                 // Position/size title panel / shadow panels
                 {
                     const UI::Point pos0 = p + mouseDownOffset + UI::Size{0,-1}; // -1 to account for the additional header line while dragging
-                    const UI::Size size = _drag.titlePanel->sizeIntrinsic({titlePanel->size().x, ConstraintNone});
+                    const UI::Size size = _drag.titlePanel->sizeIntrinsic({mouseDownPanel->size().x, ConstraintNone});
                     _drag.titlePanel->frame({pos0, size});
                     
                     // Position/size shadowPanels
@@ -965,6 +1076,7 @@ private:
                 }
                 
                 // Update insertion marker
+                _insertionMarkerDamage();
                 if (ipos) {
                     constexpr int InsertionExtraWidth = 6;
                     const UI::CommitPanelVec& ipanels = ipos->col->panels();
@@ -982,7 +1094,7 @@ private:
                 }
             }
             
-            eraseNeeded(true); // Need to erase the insertion marker
+            drawNeeded(true); // Need to draw the insertion marker
             ev = eventNext();
             abort = (ev.type != UI::Event::Type::Mouse);
             // Check if we should abort
@@ -994,7 +1106,7 @@ private:
         std::optional<_GitOp> gitOp;
         if (!abort) {
             if (_drag.titlePanel && ipos) {
-                Git::Commit dstCommit = ((ipos->iter != ipos->col->panels().end()) ? (*ipos->iter)->commit() : nullptr);
+                Git::Commit dstCommit = _insertionCommit(*ipos);
                 gitOp = _GitOp{
                     .type = (_drag.copy ? _GitOp::Type::Copy : _GitOp::Type::Move),
                     .src = {
@@ -1012,7 +1124,7 @@ private:
             } else if (!mouseDragged) {
                 _selection = {
                     .rev = mouseDownColumn->rev(),
-                    .commits = {mouseDownPanel->commit()},
+                    .commits = {_repo.commitLookup(mouseDownPanel->commit().id)},
                 };
                 
                 auto currentTime = std::chrono::steady_clock::now();
@@ -1037,7 +1149,7 @@ private:
                         };
                     
                     } else {
-                        beep();
+                        backend().beep();
                     }
                 }
                 
@@ -1054,7 +1166,7 @@ private:
         // The dragged panels need layout
         layoutNeeded(true);
         // We need one more erase to erase the insertion marker
-        eraseNeeded(true);
+        _insertionMarkerDamage();
         _drag = {};
         
         return gitOp;
@@ -1080,6 +1192,7 @@ private:
             const UI::Rect selectionRect = {{x,y}, {std::max(2,w),std::max(2,h)}};
             
             if (_selectionRect || dragStart) {
+                _selectionRectDamage();
                 _selectionRect = selectionRect;
             }
             
@@ -1091,7 +1204,7 @@ private:
                         const UI::Rect panelFrame = SuperviewConvert(*col, panel->frame());
                         if (!Empty(Intersection(selectionRect, panelFrame))) {
                             selectionNew.rev = col->rev();
-                            selectionNew.commits.insert(panel->commit());
+                            selectionNew.commits.insert(_repo.commitLookup(panel->commit().id));
                         }
                     }
                     if (!selectionNew.commits.empty()) break;
@@ -1117,7 +1230,7 @@ private:
                 }
             }
             
-            eraseNeeded(true); // Need to erase the selection rect
+            drawNeeded(true); // Need to draw the selection rect
             ev = eventNext();
             // Check if we should abort
             if (ev.type!=UI::Event::Type::Mouse || ev.mouseUp()) {
@@ -1126,10 +1239,24 @@ private:
         }
         
         // Reset state
-        eraseNeeded(true); // We need one more erase to erase the selection rect upon mouse-up
+        _selectionRectDamage(); // We need one more erase to erase the selection rect upon mouse-up
         _selectionRect = std::nullopt;
     }
     
+    // _insertionMarkerDamage(): erases the current insertion marker on the next draw
+    void _insertionMarkerDamage() {
+        if (!_drag.insertionMarker) return;
+        const UI::Rect& r = *_drag.insertionMarker;
+        damage({r.origin, {r.size.x, 1}});
+    }
+    
+    // _selectionRectDamage(): erases the current selection rect on the next draw
+    // Only the rect's border is drawn, so the views within it are left alone.
+    void _selectionRectDamage() {
+        if (!_selectionRect) return;
+        for (const UI::Rect& r : UI::BorderRects(*_selectionRect)) damage(r);
+    }
+    
     enum class _RevCreateType {
         MatchTemplate,
         Branch,
@@ -1203,7 +1330,8 @@ private:
         const Rev rev(ref);
         auto it = std::find(_revs.begin(), _revs.end(), revTemplate);
         assert(it != _revs.end());
-        _revs.insert(it+1, rev);
+        it = _revs.insert(it+1, rev);
+        _revScrollToVisible(it-_revs.begin());
         
         // Set our selection to the first commit of the new ref
         _selection = {
@@ -1214,7 +1342,7 @@ private:
         _reload();
         
         const UI::RevColumnPtr col = _columnForRev(rev);
-        if (!col) return; // It's possible that col==null because the new column is offscreen!
+        if (!col) return; // It's possible that col==null because the window is too narrow to fit any columns
         _revColumnNameSetFocused(col, false, true);
     }
     
@@ -1278,7 +1406,7 @@ private:
         if (!_selected(mouseDownColumn, mouseDownPanel)) {
             _selection = {
                 .rev = mouseDownColumn->rev(),
-                .commits = {mouseDownPanel->commit()},
+                .commits = {_repo.commitLookup(mouseDownPanel->commit().id)},
             };
         }
         
@@ -1354,16 +1482,17 @@ private:
             throw Toastbox::RuntimeError("failed to find commit %s", refState.head.c_str());
         }
         
+        // Rename the ref if the name changed, pointing the new ref at `commit` as part
+        // of the same transaction
+        if (ref.name() != refState.name) {
+            return _gitRefRename(ref, refState.name, commit);
+        }
+        
         // Set the ref's commit if it changed
         if (ref.commit() != commit) {
             ref = _gitRefReplace(ref, commit);
         }
         
-        // Rename the ref if the name changed
-        if (ref.name() != refState.name) {
-            ref = _gitRefRename(ref, refState.name);
-        }
-        
         return ref;
     }
     
@@ -1454,15 +1583,184 @@ private:
         _reload();
     }
     
-    void _gitOpExec(const _GitOp& gitOp) {
+    // _GitOpTask: state shared between the UI thread and the worker thread that executes a git operation
+    struct _GitOpTask {
+        std::mutex lock;
+        std::condition_variable signal;
+        
+        // call: a function that the worker thread needs to execute on the UI thread
+        std::function<void()> call;
+        std::exception_ptr callErr;
+        bool callDone = false;
+        
+        std::atomic<size_t> progress = 0;
+        std::atomic<bool> cancel = false;
+        
+        bool done = false;
+        std::optional<_GitModify::OpResult> result;
+        std::exception_ptr err;
+    };
+    
+    // _GitOpTaskCall(): executes `fn` on the UI thread, from the worker thread, and waits for it to complete
+    static void _GitOpTaskCall(_GitOpTask& task, const std::function<void()>& fn) {
+        std::unique_lock lock(task.lock);
+        // Don't start new calls once the operation has been canceled; this also
+        // guarantees that the UI thread never abandons a call that's waiting
+        if (task.cancel) throw _GitModify::Canceled();
+        task.call = fn;
+        task.callErr = nullptr;
+        task.callDone = false;
+        task.signal.notify_all();
+        task.signal.wait(lock, [&] { return task.callDone; });
+        if (task.callErr) std::rethrow_exception(task.callErr);
+    }
+    
+    // _gitOpTaskRun(): executes the git operation on a worker thread, while the UI thread
+    // services the worker's callbacks and displays the operation's progress
+    std::optional<_GitModify::OpResult> _gitOpTaskRun(const _GitOp& gitOp) {
+        using namespace std::chrono;
+        _GitOpTask task;
+        
+        // Callbacks that touch the UI or our state are marshalled to the UI thread
         const _GitModify::Ctx ctx = {
             .repo = _repo,
-            .refReplace = [&] (const Git::Ref& ref, const Git::Commit& commit) { return _gitRefReplace(ref, commit); },
-            .spawn = [&] (const char*const* argv) { _gitSpawn(argv); },
-            .conflictsResolve = [&] (const Git::Index& index, const std::vector<Git::Conflict>& fcs) { _gitConflictsResolve(gitOp, index, fcs); },
+            .refReplace = [&] (const Git::Transaction& tx, const Git::Ref& ref, const Git::Commit& commit, const Git::Id& target) {
+                _GitOpTaskCall(task, [&] {
+                    // Detach HEAD if it's attached to the ref that we're modifying, otherwise
+                    // we'll get an error when the transaction replaces that ref.
+                    _gitDetachHeadIfEqual(ref);
+                    _repo.refReplace(tx, ref, commit, target);
+                });
+            },
+            .spawn = [&] (const char*const* argv) {
+                _GitOpTaskCall(task, [&] { _gitSpawn(argv); });
+            },
+            .conflictsResolve = [&] (const Git::Index& index, const std::vector<Git::Conflict>& fcs) {
+                _GitOpTaskCall(task, [&] { _gitConflictsResolve(gitOp, index, fcs); });
+            },
+            .progress = [&] {
+                if (task.cancel) throw _GitModify::Canceled();
+                task.progress++;
+            },
+            .rewriteCache = _rewriteCache.get(),
         };
         
-        auto opResult = _GitModify::Exec(ctx, gitOp);
+        std::thread thread([&] {
+            std::optional<_GitModify::OpResult> result;
+            std::exception_ptr err;
+            try {
+                result = _GitModify::Exec(ctx, gitOp);
+            } catch (...) {
+                err = std::current_exception();
+            }
+            
+            std::lock_guard lock(task.lock);
+            task.result = result;
+            task.err = err;
+            task.done = true;
+            task.signal.notify_all();
+        });
+        
+        // Cancel and wait for the worker thread to exit, in case we exit due to an exception
+        Defer(
+            {
+                std::lock_guard lock(task.lock);
+                task.cancel = true;
+                // Fail the worker's outstanding call, if any, so that it doesn't wait forever
+                if (task.call) {
+                    task.call = nullptr;
+                    task.callErr = std::make_exception_ptr(_GitModify::Canceled());
+                    task.callDone = true;
+                    task.signal.notify_all();
+                }
+            }
+            thread.join();
+        );
+        
+        const auto progressDeadline = steady_clock::now()+_GitOpProgressDelay;
+        std::optional<_PanelPresenter<UI::AlertPtr>> alert;
+        UI::ButtonSpinnerPtr spinner;
+        bool resized = false;
+        for (;;) {
+            std::function<void()> call;
+            {
+                std::unique_lock lock(task.lock);
+                // Don't show the progress panel for operations that complete quickly.
+                // Until the panel is shown, don't process events either, because our
+                // columns can't be interacted with while the operation is underway.
+                if (!alert) {
+                    task.signal.wait_until(lock, progressDeadline, [&] { return task.done || task.call; });
+                }
+                if (task.done) break;
+                call = task.call;
+            }
+            
+            if (call) {
+                // Hide the progress panel while the worker's call (eg the conflict panel) is executing
+                if (alert) (*alert)->visible(false);
+                std::exception_ptr err;
+                try {
+                    call();
+                } catch (...) {
+                    err = std::current_exception();
+                }
+                if (alert) (*alert)->visible(true);
+                
+                std::lock_guard lock(task.lock);
+                task.call = nullptr;
+                task.callErr = err;
+                task.callDone = true;
+                task.signal.notify_all();
+                continue;
+            }
+            
+            if (!alert) {
+                alert.emplace(_panels, subviewCreate<UI::Alert>());
+                (*alert)->width                         (40);
+                (*alert)->color                         (colors().menu);
+                (*alert)->title()->text                 (_GitOpTitle(gitOp));
+                (*alert)->dismissButton()->label()->text("Cancel");
+                (*alert)->dismissButton()->action       ( [&] (UI::Button&) { task.cancel = true; } );
+                spinner = UI::ButtonSpinner::Create((*alert)->dismissButton());
+            }
+            
+            const size_t progress = task.progress;
+            (*alert)->message()->text((task.cancel ? "Canceling…" :
+                "Processed " + std::to_string(progress) + " commit" + (progress!=1 ? "s" : "") + "…"));
+            spinner->animate();
+            
+            // Handle events until the next animation frame.
+            // Bypass our track() override, which reloads our columns when the window is resized,
+            // because the worker thread is using the repository.
+            try {
+                UI::Screen::track(steady_clock::now()+_GitOpProgressInterval);
+            } catch (const UI::WindowResize&) {
+                eraseNeeded(true);
+                resized = true;
+            }
+        }
+        
+        // The worker is done with the repository, so we can reload our columns for
+        // the new window size
+        if (resized) _reload();
+        
+        if (task.err) std::rethrow_exception(task.err);
+        return task.result;
+    }
+    
+    static std::string _GitOpTitle(const _GitOp& gitOp) {
+        switch (gitOp.type) {
+        case _GitOp::Type::Move:    return "Moving Commits";
+        case _GitOp::Type::Copy:    return "Copying Commits";
+        case _GitOp::Type::Delete:  return "Deleting Commits";
+        case _GitOp::Type::Combine: return "Combining Commits";
+        case _GitOp::Type::Edit:    return "Editing Commit";
+        default:                    return "Working";
+        }
+    }
+    
+    void _gitOpExec(const _GitOp& gitOp) {
+        auto opResult = _gitOpTaskRun(gitOp);
         if (!opResult) return;
         
         Rev srcRevPrev = gitOp.src.rev;
@@ -1509,30 +1807,13 @@ private:
         _reload();
     }
     
-    void _cursesInit() noexcept {
-        // Default Linux installs may not contain the /usr/share/terminfo database,
-        // so provide a fallback terminfo that usually works.
-        nc_set_default_terminfo(xterm_256color, sizeof(xterm_256color));
-        
-        // Override the terminfo 'kmous' and 'XM' properties to permit mouse-moved events,
-        // in addition to the default mouse-down/up events.
-        //   kmous = the prefix used to detect/parse mouse events
-        //   XM    = the escape string used to enable mouse events (1006=SGR 1006 mouse
-        //           event mode; 1003=report mouse-moved events in addition to clicks)
-        setenv("TERM_KMOUS", "\x1b[<", true);
-        setenv("TERM_XM", "\x1b[?1006;1003%?%p1%{1}%=%th%el%;", true);
+    void _renderInit() noexcept {
+        backend().init();
         
-        ::initscr();
-        ::noecho();
-        ::raw();
-        
-        ::use_default_colors();
-        ::start_color();
-        
-        if (can_change_color()) {
-            colors(_ColorsCreate(_theme));
+        if (backend().colorsChangeable()) {
+            colors(_ColorsCreate(backend(), _theme));
         } else {
-            colors(_ColorsCreateDefault());
+            colors(_ColorsCreateDefault(backend()));
         }
         
 //        _colorsPrev = _ColorsSet(_colors);
@@ -1541,17 +1822,9 @@ private:
 //        View::Colors(_colors);
         
 //        _cursorState = UI::CursorState(false, {});
-        
-        // Hide cursor
-        ::curs_set(0);
-        
-        ::mousemask(ALL_MOUSE_EVENTS | REPORT_MOUSE_POSITION, NULL);
-        ::mouseinterval(0);
-        
-        ::set_escdelay(0);
     }
 
-    void _cursesDeinit() noexcept {
+    void _renderDeinit() noexcept {
     //    ::mousemask(0, NULL);
         
 //        _cursorState.restore();
@@ -1560,14 +1833,70 @@ private:
         colors({});
         
 //        _ColorsSet(_colorsPrev);
-        ::endwin();
+        backend().deinit();
         
     //    sleep(1);
     }
     
+    // _dirtyCheckStart(): checks for uncommitted changes on a background thread
+    void _dirtyCheckStart() {
+        // Repo handles can't be used by multiple threads, so give the thread its own
+        _dirtyCheck.thread = std::thread([this, repo=_repo.reopen()] {
+            try {
+                _dirtyCheck.dirty = repo.dirty(&_dirtyCheck.cancel);
+            } catch (...) {
+                _dirtyCheck.err = std::current_exception();
+            }
+            _dirtyCheck.done = true;
+        });
+    }
+    
+    void _dirtyCheckCancel() {
+        if (!_dirtyCheck.thread.joinable()) return;
+        _dirtyCheck.cancel = true;
+        _dirtyCheck.thread.join();
+    }
+    
+    // _dirtyCheckUpdate(): applies the result of the dirty check once it's complete, by
+    // marking all revs that match HEAD's ref as immutable if the repo has uncommitted
+    // changes. If `wait`=true, waits for the check to complete first.
+    void _dirtyCheckUpdate(bool wait) {
+        if (!_dirtyCheck.thread.joinable()) return;
+        if (!wait && !_dirtyCheck.done) return;
+        _dirtyCheck.thread.join();
+        
+        // Assume there are uncommitted changes if the check failed
+        const bool dirty = _dirtyCheck.dirty || _dirtyCheck.err;
+        if (dirty && _head.ref) {
+            for (Rev& rev : _revs) {
+                if (rev.ref && rev.ref==_head.ref) {
+                    rev.mutability = Rev::Mutability::DisallowedUncommittedChanges;
+                }
+            }
+            
+            if (_selection.rev.ref && _selection.rev.ref==_head.ref) {
+                _selection.rev.mutability = Rev::Mutability::DisallowedUncommittedChanges;
+            }
+            
+            _reload();
+        }
+        
+        if (_dirtyCheck.err) std::rethrow_exception(_dirtyCheck.err);
+    }
+    
     bool _gitDetachHeadIfEqual(const Git::Ref& ref) {
         assert(ref);
         if (_head.ref != ref) return false;
+        
+        // The ref that HEAD is attached to can't be modified if the repo has uncommitted
+        // changes. The dirty check may still be running, in which case its result hasn't
+        // been applied to our revs yet.
+        _dirtyCheckUpdate(true);
+        const auto it = std::find_if(_revs.begin(), _revs.end(), [&] (const Rev& rev) { return rev.ref==ref; });
+        if (it!=_revs.end() && it->mutability==Rev::Mutability::DisallowedUncommittedChanges) {
+            throw Toastbox::RuntimeError("%s has uncommitted changes", ref.name().c_str());
+        }
+        
         if (!_headReattach) {
             _headReattach = true;
             _repo.headDetach();
@@ -1575,8 +1904,19 @@ private:
         return true;
     }
     
-    Git::Ref _gitRefRename(const Git::Ref& refPrev, const std::string& name) {
-        const Git::Ref ref = _repo.refCopy(refPrev, name);
+    // _gitRefRename(): renames `refPrev` to `name`, and points it at `commit` (or
+    // `refPrev`'s commit if `commit` is null)
+    Git::Ref _gitRefRename(const Git::Ref& refPrev, const std::string& name, const Git::Commit& commit=nullptr) {
+        // Create the new ref and delete the original one in a single transaction, so
+        // that we never end up with both refs, or neither
+        const Git::Transaction tx = _repo.transactionCreate();
+        const std::string fullName = _repo.refCopy(tx, refPrev, name, commit);
+        _repo.refDelete(tx, refPrev);
+        
+        const bool head = _gitDetachHeadIfEqual(refPrev);
+        _repo.transactionCommit(tx);
+        _repo.reflogDelete(refPrev);
+        const Git::Ref ref = _repo.refFullNameLookup(fullName);
         
         // Update all revs in _revs
         for (Rev& rev : _revs) {
@@ -1589,7 +1929,7 @@ private:
         _repoState.refReplace(refPrev, ref);
         
         // Update _head
-        if (_gitDetachHeadIfEqual(refPrev)) {
+        if (head) {
             _head.ref = ref;
         }
         
@@ -1600,13 +1940,13 @@ private:
         
         // Remember the new ref so it appears in subsequent debase launches
         _repo.reflogRememberRef(ref);
-        
-        // Delete the original ref
-        _repo.refDelete(refPrev);
         return ref;
     }
     
     void _gitRefDelete(const Git::Ref& ref) {
+        // Detach HEAD before updating our state, since it throws if `ref` can't be modified
+        const bool head = _gitDetachHeadIfEqual(ref);
+        
         // Update _revs by removing revs that match `ref`
         _revs.erase(
             std::remove_if(_revs.begin(), _revs.end(), [&] (const Rev& rev) { return rev.ref==ref; }),
@@ -1616,7 +1956,7 @@ private:
         _repoState.refRemove(ref);
         
         // Update _head
-        if (_gitDetachHeadIfEqual(ref)) {
+        if (head) {
             _head = {};
         }
         
@@ -1638,15 +1978,15 @@ private:
     
     void _gitSpawn(const char*const* argv) {
         // preserveTerminalCmds: these commands don't modify the terminal, and therefore
-        // we don't want to deinit/reinit curses when calling them.
-        // When invoking commands such as vi/pico, we need to deinit/reinit curses
+        // we don't want to deinit/reinit the backend when calling them.
+        // When invoking commands such as vi/pico, we need to deinit/reinit the backend
         // when calling out to them, because those commands reconfigure the terminal.
         static const std::set<std::string> preserveTerminalCmds = {
             "mate"
         };
         
         const bool preserveTerminal = preserveTerminalCmds.find(argv[0]) != preserveTerminalCmds.end();
-        if (!preserveTerminal) _cursesDeinit();
+        if (!preserveTerminal) _renderDeinit();
         
         // Spawn the text editor and wait for it to exit
         {
@@ -1662,7 +2002,7 @@ private:
             if (ir != pid) throw Toastbox::RuntimeError("unknown waitpid result: %d", ir);
         }
         
-        if (!preserveTerminal) _cursesInit();
+        if (!preserveTerminal) _renderInit();
     }
     
     std::string _gitConflictResolveInEditor(const Git::Conflict& fc) {
@@ -2071,9 +2411,24 @@ private:
     std::vector<Rev> _revs;
     
     State::RepoState _repoState;
+    std::unique_ptr<Git::RewriteCache> _rewriteCache;
+    
+    struct {
+        std::thread thread;
+        std::atomic<bool> cancel = false;
+        std::atomic<bool> done = false;
+        // Written by `thread` before it sets `done`
+        bool dirty = false;
+        std::exception_ptr err;
+    } _dirtyCheck;
+    
     Git::Rev _head;
     bool _headReattach = false;
     std::vector<UI::RevColumnPtr> _columns;
+    // Index in `_revs` of the leftmost visible column
+    size_t _revScroll = 0;
+    // Scroll offsets of the columns that were destroyed when scrolled out of view
+    std::vector<std::pair<Rev,size_t>> _columnScrollOffsets;
     UI::RevColumnPtr _columnNameFocused;
     State::Theme _theme = State::Theme::None;
     
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+#include "lib/toastbox/RuntimeError.h"
+
+// Check: helpers shared by the check programs (src/*Check.cpp)
+
+namespace Check {
+
+// Env: creates a temporary directory that's deleted when the Env is destroyed, and
+// points HOME/XDG_CONFIG_HOME within it to isolate the check from the user's git
+// config and debase state
+class Env {
+public:
+    Env(const std::string& name) {
+        _dir = std::filesystem::temp_directory_path() / ("debase-" + name + "-" + std::to_string(getpid()));
+        std::filesystem::create_directories(_dir/"home");
+        setenv("HOME", (_dir/"home").c_str(), true);
+        setenv("XDG_CONFIG_HOME", (_dir/"home"/".config").c_str(), true);
+        
+        std::ofstream config(_dir/"home"/".gitconfig");
+        config << "[user]\n\tname = Jane Doe\n\temail = jane@example.com\n";
+        config << "[init]\n\tdefaultBranch = master\n";
+        // Allow submodules with local URLs
+        config << "[protocol \"file\"]\n\tallow = always\n";
+    }
+    
+    ~Env() {
+        std::error_code ec;
+        std::filesystem::remove_all(_dir, ec);
+    }
+    
+    Env(const Env&) = delete;
+    Env& operator =(const Env&) = delete;
+    
+    const std::filesystem::path& dir() const { return _dir; }
+    
+private:
+    std::filesystem::path _dir;
+};
+
+// GitOutput(): runs git with `args` in `dir`, and returns its output
+inline std::string GitOutput(const std::filesystem::path& dir, const std::string& args) {
+    const std::string cmd = "git -C '" + dir.string() + "' " + args + " 2>/dev/null";
+    FILE* f = popen(cmd.c_str(), "r");
+    if (!f) throw Toastbox::RuntimeError("popen failed: %s", cmd.c_str());
+    std::string r;
+    char buf[256];
+    for (size_t len; (len=fread(buf, 1, sizeof(buf), f));) r.append(buf, len);
+    const int ir = pclose(f);
+    if (ir) throw Toastbox::RuntimeError("command failed: %s", cmd.c_str());
+    return r;
+}
+
+// GitRun(): runs git with `args` in `dir`
+inline void GitRun(const std::filesystem::path& dir, const std::string& args) {
+    GitOutput(dir, args);
+}
+
+// GitId(): returns the commit id that `rev` resolves to in `dir`
+inline std::string GitId(const std::filesystem::path& dir, const std::string& rev) {
+    std::string r = GitOutput(dir, "rev-parse '" + rev + "'");
+    while (!r.empty() && r.back()=='\n') r.pop_back();
+    return r;
+}
+
+} // namespace Check
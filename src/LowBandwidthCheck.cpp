@@ -0,0 +1,405 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include "lib/toastbox/Defer.h"
+#include "lib/toastbox/RuntimeError.h"
+#include "ui/LowBandwidthRenderer.h"
+#include "xterm-256color.h"
+
+// LowBandwidthCheck: draws a series of frames with ncurses, renders them with
+// LowBandwidthRenderer, and replays the renderer's output on a model terminal to
+// verify that the terminal ends up displaying each frame
+// Invoked by `make check`; exits with a nonzero status on failure.
+
+using namespace UI;
+
+static constexpr Size _ScreenSize = {40, 12};
+static constexpr size_t _RandomFrameCount = 200;
+
+// _Attr: the attributes of a cell, in terms that both ncurses and SGR can express
+struct _Attr {
+    bool bold = false;
+    bool underline = false;
+    bool reverse = false;
+    short fg = -1;
+    short bg = -1;
+    
+    bool operator ==(const _Attr& x) const {
+        return bold==x.bold && underline==x.underline && reverse==x.reverse && fg==x.fg && bg==x.bg;
+    }
+    bool operator !=(const _Attr& x) const { return !(*this == x); }
+};
+
+// _Term: a model of a terminal that understands the subset of escape sequences that
+// LowBandwidthRenderer writes
+class _Term {
+public:
+    struct Cell {
+        char32_t c = ' ';
+        // The cell is covered by the wide character to its left
+        bool cont = false;
+        _Attr attr;
+    };
+    
+    _Term(Size size) : _size(size), _cells(size.x*size.y) {}
+    
+    // write(): interprets `frame`, the output of one call to LowBandwidthRenderer::render()
+    void write(std::string_view frame) {
+        constexpr std::string_view SyncBegin = "\x1b[?2026h";
+        constexpr std::string_view SyncEnd = "\x1b[?2026l";
+        if (frame.substr(0, SyncBegin.size())!=SyncBegin || frame.size()<SyncEnd.size() ||
+            frame.substr(frame.size()-SyncEnd.size())!=SyncEnd) {
+            throw Toastbox::RuntimeError("frame isn't wrapped in synchronized-output markers");
+        }
+        frame = frame.substr(SyncBegin.size(), frame.size()-SyncBegin.size()-SyncEnd.size());
+        
+        while (!frame.empty()) {
+            if (frame[0] == '\x1b') {
+                frame = _escape(frame);
+            } else {
+                size_t len = 0;
+                _put(UTF8::Decode(frame, len));
+                frame.remove_prefix(len);
+            }
+        }
+    }
+    
+    // positionInvalidate(): makes the cursor position unknown, like it is before the
+    // first frame that the renderer writes after sync()
+    void positionInvalidate() { _posValid = false; }
+    
+    const Cell& cell(const Point& p) const { return _cells[p.y*_size.x + p.x]; }
+    const Point& pos() const { return _pos; }
+    bool posValid() const { return _posValid; }
+    bool cursorVisible() const { return _cursorVisible; }
+    
+    void cellSet(const Point& p, const Cell& x) { _cell(p) = x; }
+    
+private:
+    Cell& _cell(const Point& p) { return _cells[p.y*_size.x + p.x]; }
+    
+    void _put(char32_t c) {
+        if (!_posValid) throw Toastbox::RuntimeError("character written at an unknown cursor position");
+        // Terminals differ in whether they wrap when writing to the last column, so the
+        // renderer must never write past it
+        const int width = (UTF8::CodepointWidth(c)>1 ? 2 : 1);
+        if (_pos.x+width > _size.x) throw Toastbox::RuntimeError("character written past the last column");
+        
+        const Point p = _pos;
+        // Overwriting either half of a wide character erases the other half
+        if (_cell(p).cont) _cell({p.x-1,p.y}) = Cell{.attr = _cell({p.x-1,p.y}).attr};
+        const int end = p.x+width;
+        if (end<_size.x && _cell({end,p.y}).cont) _cell({end,p.y}) = Cell{.attr = _cell({end,p.y}).attr};
+        
+        _cell(p) = Cell{ .c = c, .attr = _attr };
+        if (width > 1) _cell({p.x+1,p.y}) = Cell{ .c = 0, .cont = true, .attr = _attr };
+        
+        _pos.x += width;
+        // The cursor position after writing to the last column depends on the terminal
+        if (_pos.x >= _size.x) _posValid = false;
+    }
+    
+    // _escape(): interprets the escape sequence at the beginning of `x`, returning the
+    // remainder of `x`
+    std::string_view _escape(std::string_view x) {
+        if (x.size()<2 || x[1]!='[') throw Toastbox::RuntimeError("unexpected escape sequence");
+        size_t i = 2;
+        const bool priv = (i<x.size() && x[i]=='?');
+        if (priv) i++;
+        
+        std::vector<int> params;
+        int param = -1;
+        for (; i<x.size(); i++) {
+            const char c = x[i];
+            if (c>='0' && c<='9') {
+                param = (param<0 ? 0 : param*10) + (c-'0');
+            } else if (c == ';') {
+                params.push_back(param);
+                param = -1;
+            } else {
+                break;
+            }
+        }
+        if (i >= x.size()) throw Toastbox::RuntimeError("truncated escape sequence");
+        params.push_back(param);
+        const char cmd = x[i];
+        const auto paramGet = [&] (size_t idx, int def) {
+            return (idx<params.size() && params[idx]>=0 ? params[idx] : def);
+        };
+        
+        if (priv && (cmd=='h' || cmd=='l') && paramGet(0,0)==25) {
+            _cursorVisible = (cmd == 'h');
+        
+        } else if (!priv && cmd=='H') {
+            _pos = {paramGet(1,1)-1, paramGet(0,1)-1};
+            if (_pos.x<0 || _pos.y<0 || _pos.x>=_size.x || _pos.y>=_size.y) {
+                throw Toastbox::RuntimeError("cursor moved off screen");
+            }
+            _posValid = true;
+        
+        } else if (!priv && cmd=='C') {
+            if (!_posValid) throw Toastbox::RuntimeError("relative cursor movement from an unknown position");
+            _pos.x += paramGet(0,1);
+            if (_pos.x >= _size.x) throw Toastbox::RuntimeError("cursor moved off screen");
+        
+        } else if (!priv && cmd=='m') {
+            _sgr(params);
+        
+        } else {
+            throw Toastbox::RuntimeError("unexpected escape sequence: %s",
+                std::string(x.substr(1, i)).c_str());
+        }
+        return x.substr(i+1);
+    }
+    
+    void _sgr(const std::vector<int>& params) {
+        for (size_t i=0; i<params.size(); i++) {
+            const int p = std::max(0, params[i]);
+            if (p == 0)                 _attr = {};
+            else if (p == 1)            _attr.bold = true;
+            else if (p == 4)            _attr.underline = true;
+            else if (p == 7)            _attr.reverse = true;
+            else if (p>=30 && p<=37)    _attr.fg = p-30;
+            else if (p>=40 && p<=47)    _attr.bg = p-40;
+            else if (p>=90 && p<=97)    _attr.fg = p-90+8;
+            else if (p>=100 && p<=107)  _attr.bg = p-100+8;
+            else if ((p==38 || p==48) && i+2<params.size() && params[i+1]==5) {
+                (p==38 ? _attr.fg : _attr.bg) = params[i+2];
+                i += 2;
+            } else {
+                throw Toastbox::RuntimeError("unexpected SGR parameter: %d", p);
+            }
+        }
+    }
+    
+    Size _size;
+    std::vector<Cell> _cells;
+    Point _pos;
+    bool _posValid = false;
+    bool _cursorVisible = false;
+    _Attr _attr;
+};
+
+// _Random: deterministic pseudorandom numbers, so that failures are reproducible
+struct _Random {
+    uint32_t state = 1;
+    uint32_t operator()(uint32_t n) {
+        state = state*1664525 + 1013904223;
+        return (state>>8) % n;
+    }
+};
+
+// _ScrCell(): returns the character at `p` in `scr`, its width, and its attributes
+static _Term::Cell _ScrCell(WINDOW* scr, const Point& p, int& width) {
+    cchar_t cc = {};
+    mvwin_wch(scr, p.y, p.x, &cc);
+    wchar_t chars[CCHARW_MAX+1] = {};
+    attr_t attr = 0;
+    short pair = 0;
+    ::getcchar(&cc, chars, &attr, &pair, nullptr);
+    
+    _Term::Cell cell = { .c = (char32_t)(chars[0] ? chars[0] : ' ') };
+    cell.attr.bold = attr & A_BOLD;
+    cell.attr.underline = attr & A_UNDERLINE;
+    cell.attr.reverse = attr & (A_REVERSE|A_STANDOUT);
+    if (pair) ::pair_content(pair, &cell.attr.fg, &cell.attr.bg);
+    width = (UTF8::CodepointWidth(cell.c)>1 ? 2 : 1);
+    // Like LowBandwidthRenderer, display wide characters that start in the last column
+    // as spaces
+    if (width>1 && p.x+1>=getmaxx(scr)) {
+        cell.c = ' ';
+        width = 1;
+    }
+    return cell;
+}
+
+// _Verify(): verifies that `term` displays the contents of `scr`
+static void _Verify(WINDOW* scr, const _Term& term, const CursorState& cursor, size_t frame) {
+    for (int y=0; y<_ScreenSize.y; y++) {
+        for (int x=0; x<_ScreenSize.x;) {
+            int width = 1;
+            const _Term::Cell expected = _ScrCell(scr, {x,y}, width);
+            const _Term::Cell& actual = term.cell({x,y});
+            bool ok = (actual.c==expected.c && !actual.cont && actual.attr==expected.attr);
+            if (width > 1) ok &= term.cell({x+1,y}).cont;
+            if (!ok) {
+                throw Toastbox::RuntimeError("frame %zu: cell (%d,%d) is U+%04X, expected U+%04X",
+                    frame, x, y, (unsigned)actual.c, (unsigned)expected.c);
+            }
+            x += width;
+        }
+    }
+    
+    if (term.cursorVisible() != cursor.visible) {
+        throw Toastbox::RuntimeError("frame %zu: cursor visibility is wrong", frame);
+    }
+    
+    if (cursor.visible && (!term.posValid() || term.pos().x!=cursor.origin.x || term.pos().y!=cursor.origin.y)) {
+        throw Toastbox::RuntimeError("frame %zu: cursor position is wrong", frame);
+    }
+}
+
+static void _Put(WINDOW* win, const Point& p, const wchar_t* str, attr_t attr, short pair) {
+    ::wattr_set(win, attr, pair, nullptr);
+    mvwaddwstr(win, p.y, p.x, str);
+    ::wattr_set(win, 0, 0, nullptr);
+}
+
+int main(int argc, const char* argv[]) {
+    // Text widths depend on the locale (via wcwidth()), so use a UTF-8 locale regardless
+    // of the environment
+    if (!setlocale(LC_ALL, "C.UTF-8") && !setlocale(LC_ALL, "en_US.UTF-8")) {
+        fprintf(stderr, "Error: no UTF-8 locale available\n");
+        return 1;
+    }
+    
+    try {
+        // ncurses writes to /dev/null; we only need its virtual screen
+        FILE* devNull = fopen("/dev/null", "r+");
+        if (!devNull) throw Toastbox::RuntimeError("failed to open /dev/null: %s", strerror(errno));
+        Defer(fclose(devNull));
+        
+        setenv("LINES", std::to_string(_ScreenSize.y).c_str(), true);
+        setenv("COLUMNS", std::to_string(_ScreenSize.x).c_str(), true);
+        nc_set_default_terminfo(xterm_256color, sizeof(xterm_256color));
+        SCREEN* screen = ::newterm("xterm-256color", devNull, devNull);
+        if (!screen) throw Toastbox::RuntimeError("newterm failed");
+        Defer(::delscreen(screen));
+        Defer(::endwin());
+        
+        ::use_default_colors();
+        ::start_color();
+        const short pairCount = 4;
+        ::init_pair(1, COLOR_RED, -1);
+        ::init_pair(2, COLOR_WHITE, COLOR_BLUE);
+        ::init_pair(3, 12, -1);     // Bright color
+        ::init_pair(4, 208, 236);   // 256-color
+        
+        // The renderer's output is read back via a pipe, which has room for many
+        // more bytes than a frame of this size can produce
+        int fds[2];
+        int ir = pipe(fds);
+        if (ir) throw Toastbox::RuntimeError("pipe failed: %s", strerror(errno));
+        Defer(close(fds[0]));
+        Defer(close(fds[1]));
+        ir = fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        if (ir) throw Toastbox::RuntimeError("fcntl failed: %s", strerror(errno));
+        
+        LowBandwidthRenderer renderer(fds[1]);
+        _Term term(_ScreenSize);
+        
+        const auto outputRead = [&] {
+            std::string r;
+            char buf[4096];
+            for (;;) {
+                const ssize_t sr = read(fds[0], buf, sizeof(buf));
+                if (sr <= 0) break;
+                r.append(buf, sr);
+            }
+            return r;
+        };
+        
+        // Frame 0: written by ncurses, and adopted by the renderer and our terminal
+        _Put(stdscr, {2,1}, L"debase", A_BOLD, 1);
+        _Put(stdscr, {2,2}, L"Handle 日本語 text", 0, 0);
+        _Put(stdscr, {2,3}, L"Selected", A_REVERSE, 2);
+        ::refresh();
+        CursorState cursor;
+        renderer.sync(newscr, cursor);
+        for (int y=0; y<_ScreenSize.y; y++) {
+            for (int x=0; x<_ScreenSize.x;) {
+                int width = 1;
+                term.cellSet({x,y}, _ScrCell(newscr, {x,y}, width));
+                if (width>1 && x+1<_ScreenSize.x) term.cellSet({x+1,y}, {.c = 0, .cont = true});
+                x += width;
+            }
+        }
+        
+        size_t frame = 1;
+        size_t fullBytes = 0;
+        const auto frameRender = [&] {
+            ::wnoutrefresh(stdscr);
+            const size_t frameCount = renderer.stats().frameCount;
+            renderer.render(newscr, cursor);
+            const std::string out = outputRead();
+            
+            if (renderer.stats().frameCount == frameCount) {
+                if (!out.empty()) throw Toastbox::RuntimeError("frame %zu: output wasn't counted", frame);
+            } else if (renderer.stats().frameBytes != out.size()) {
+                throw Toastbox::RuntimeError("frame %zu: wrote %zu bytes but counted %zu",
+                    frame, out.size(), renderer.stats().frameBytes);
+            }
+            
+            if (!out.empty()) {
+                try {
+                    term.write(out);
+                } catch (const std::exception& e) {
+                    throw Toastbox::RuntimeError("frame %zu: %s", frame, e.what());
+                }
+            }
+            _Verify(newscr, term, cursor, frame);
+            // Approximate the cost of rewriting the whole screen for comparison
+            fullBytes += _ScreenSize.x*_ScreenSize.y;
+            frame++;
+            return out.size();
+        };
+        
+        // The cursor position is unknown after sync()
+        term.positionInvalidate();
+        
+        // A frame with no changes writes nothing
+        if (frameRender() != 0) throw Toastbox::RuntimeError("unchanged frame wasn't empty");
+        
+        // Changing one word only writes that word (plus positioning and attributes)
+        _Put(stdscr, {9,2}, L"中文字", 0, 0);
+        if (const size_t len=frameRender(); len > 40) {
+            throw Toastbox::RuntimeError("changing one word wrote %zu bytes", len);
+        }
+        
+        // Attribute-only changes, wide characters replaced by narrow ones and vice versa,
+        // the last column, and the visible cursor
+        _Put(stdscr, {2,1}, L"debase", A_BOLD|A_UNDERLINE, 3);
+        _Put(stdscr, {10,2}, L"ab", 0, 0);
+        _Put(stdscr, {2,3}, L"Sé日", A_REVERSE, 2);
+        _Put(stdscr, {_ScreenSize.x-1,4}, L"x", 0, 4);
+        _Put(stdscr, {0,5}, L"y", 0, 4);
+        frameRender();
+        
+        cursor = {.visible = true, .origin = {5,6}};
+        frameRender();
+        cursor = {};
+        frameRender();
+        
+        // Random changes, including gaps that are cheaper to rewrite than to skip
+        _Random random;
+        const wchar_t* chars[] = { L"a", L"b", L" ", L"─", L"é", L"日", L"本" };
+        const attr_t attrs[] = { 0, A_BOLD, A_UNDERLINE, A_REVERSE };
+        for (size_t i=0; i<_RandomFrameCount; i++) {
+            const size_t changeCount = 1 + random(8);
+            for (size_t c=0; c<changeCount; c++) {
+                const Point p = {(int)random(_ScreenSize.x-1), (int)random(_ScreenSize.y)};
+                const size_t len = 1 + random(4);
+                for (size_t j=0; j<len && p.x+(int)j<_ScreenSize.x-1; j++) {
+                    _Put(stdscr, {p.x+(int)j,p.y}, chars[random(std::size(chars))],
+                        attrs[random(std::size(attrs))], (short)random(pairCount+1));
+                }
+            }
+            if (!random(10)) cursor = {.visible = true, .origin = {(int)random(_ScreenSize.x), (int)random(_ScreenSize.y)}};
+            else if (!random(5)) cursor = {};
+            frameRender();
+        }
+        
+        const LowBandwidthRenderer::Stats& stats = renderer.stats();
+        std::cout << "Rendered " << frame-1 << " frames as " << stats.frameCount << " writes totaling ";
+        std::cout << stats.totalBytes << " bytes (vs ~" << fullBytes << " bytes for full redraws)\n";
+    
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+    
+    std::cout << "Low-bandwidth output matches\n";
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include <iostream>
+#include <filesystem>
+#include "lib/toastbox/Defer.h"
+#include "App.h"
+#include "ui/HeadlessBackend.h"
+#include "Rev.h"
+#include "Check.h"
+
+// RenderCheck: renders debase's first frame for a synthetic repository via
+// HeadlessBackend, and compares it against the expected frame
+// Invoked by `make check`; exits with a nonzero status if the frames differ.
+
+static constexpr UI::Size _ScreenSize = {40, 24};
+
+static const char* _FrameExpected =
+R"(            master (HEAD)
+   ┌──────┐┌──────┐┌──────────────┐
+   │ Undo ││ Redo ││  Snapshots…  │
+   └──────┘└──────┘└──────────────┘
+
+   ┌─ edc965f ── Fri Jan 3 12:00 ─┐
+   │ Jane Doe                     │
+   │ Handle 日本語 text           │
+   │ The summary shows two lines  │
+   └──────────────────────────────┘
+
+   ┌─ 8275137 ── Thu Jan 2 12:00 ─┐
+   │ Jane Doe                     │
+   │ Add a message that is long   │
+   │ enough to wrap               │
+   └──────────────────────────────┘
+
+   ┌─ 3972274 ── Wed Jan 1 12:00 ─┐
+   │ Jane Doe                     │
+   │ Initial commit               │
+   └──────────────────────────────┘
+)";
+
+struct _Commit {
+    const char* msg = nullptr;
+    git_time_t time = 0;
+};
+
+static const _Commit _Commits[] = {
+    { "Initial commit\n",                                   1577880000 },
+    { "Add a message that is long enough to wrap\n",        1577966400 },
+    { "Handle 日本語 text\n\nThe summary shows two lines\n\nBut not three\n", 1578052800 },
+};
+
+// _RepoCreate(): creates a repository at `dir` whose master branch contains _Commits,
+// with fixed authors and times so that its rendering is deterministic
+static Git::Repo _RepoCreate(const std::filesystem::path& dir) {
+    git_repository* repo = nullptr;
+    int ir = git_repository_init(&repo, dir.c_str(), false);
+    if (ir) throw Git::Error(ir, "git_repository_init failed");
+    Defer(git_repository_free(repo));
+    
+    // Every commit has an empty tree
+    Git::Tree tree;
+    {
+        git_treebuilder* builder = nullptr;
+        ir = git_treebuilder_new(&builder, repo, nullptr);
+        if (ir) throw Git::Error(ir, "git_treebuilder_new failed");
+        Defer(git_treebuilder_free(builder));
+        
+        Git::Id id;
+        ir = git_treebuilder_write(&id, builder);
+        if (ir) throw Git::Error(ir, "git_treebuilder_write failed");
+        
+        git_tree* x = nullptr;
+        ir = git_tree_lookup(&x, repo, &id);
+        if (ir) throw Git::Error(ir, "git_tree_lookup failed");
+        tree = x;
+    }
+    
+    Git::Commit parent;
+    for (const _Commit& c : _Commits) {
+        const Git::Signature sig = Git::Signature::Create("Jane Doe", "jane@example.com", c.time, 0);
+        const git_commit* parents[] = { (parent ? *parent : nullptr) };
+        Git::Id id;
+        ir = git_commit_create(&id, repo, "refs/heads/master", *sig, *sig, nullptr,
+            c.msg, *tree, (parent ? 1 : 0), parents);
+        if (ir) throw Git::Error(ir, "git_commit_create failed");
+        
+        git_commit* x = nullptr;
+        ir = git_commit_lookup(&x, repo, &id);
+        if (ir) throw Git::Error(ir, "git_commit_lookup failed");
+        parent = x;
+    }
+    
+    // Don't depend on the default branch name (init.defaultBranch)
+    ir = git_repository_set_head(repo, "refs/heads/master");
+    if (ir) throw Git::Error(ir, "git_repository_set_head failed");
+    
+    return Git::Repo::Open(dir);
+}
+
+// _FrameText(): returns the text of `frame`, without trailing spaces
+static std::string _FrameText(const UI::HeadlessBackend::Frame& frame) {
+    std::string r;
+    for (int y=0; y<frame.size.y; y++) {
+        std::string line = frame.line(y);
+        line.erase(line.find_last_not_of(' ')+1);
+        r += line;
+        r += '\n';
+    }
+    // Ignore trailing empty lines
+    while (r.size()>=2 && r[r.size()-1]=='\n' && r[r.size()-2]=='\n') r.pop_back();
+    return r;
+}
+
+int main(int argc, const char* argv[]) {
+    // Text widths depend on the locale (via wcwidth()), so use a UTF-8 locale regardless
+    // of the environment
+    if (!setlocale(LC_ALL, "C.UTF-8") && !setlocale(LC_ALL, "en_US.UTF-8")) {
+        fprintf(stderr, "Error: no UTF-8 locale available\n");
+        return 1;
+    }
+    
+    try {
+        const Check::Env env("rendercheck");
+        
+        git_libgit2_init();
+        Defer(git_libgit2_shutdown());
+        
+        std::string frameText;
+        {
+            Git::Repo repo = _RepoCreate(env.dir()/"repo");
+            Rev rev;
+            (Git::Rev&)rev = repo.revLookup("master");
+            
+            auto backend = std::make_shared<UI::HeadlessBackend>(_ScreenSize);
+            auto app = std::make_shared<App>(repo, std::vector<Rev>{rev}, backend);
+            // With no events queued, the app renders its first frame and exits
+            app->run();
+            frameText = _FrameText(backend->frame());
+        }
+        
+        if (frameText != _FrameExpected) {
+            std::cerr << "Rendered frame doesn't match the expected frame\n";
+            std::cerr << "Expected:\n" << _FrameExpected;
+            std::cerr << "Rendered:\n" << frameText;
+            return 1;
+        }
+    
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+    
+    std::cout << "Rendered frame matches\n";
+    return 0;
+}
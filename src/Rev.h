@@ -1,5 +1,6 @@
 #pragma once
 #include "git/Git.h"
+#include "git/Ancestry.h"
 
 // Rev: wraps a Git::Rev to add additional functionality needed by debase:
 //   - skip: the number of commits to skip
@@ -46,13 +47,8 @@ public:
     // skip==0 -> return `commit`
     // skip>0  -> returns the `skip` parent of `commit`
     Git::Commit displayHead() const {
-        Git::Commit c = commit;
-        size_t s = skip;
-        while (c && s) {
-            c = c.parent();
-            s--;
-        }
-        return c;
+        if (!commit || !skip) return commit;
+        return Git::Ancestry::ForCommit(commit).ancestor(commit, skip);
     }
     
 //    bool isMutable() const {
@@ -74,6 +70,57 @@ public:
     Mutability mutability = Mutability::Allowed;
 };
 
+// RevLookup(): looks up `str`, preferring a ref-backed rev with a `skip` value for
+// strings of the form ref^ / ref~X, so that the rev remains mutable
+inline Rev RevLookup(const Git::Repo& repo, const std::string& str) {
+    Rev rev;
+    (Git::Rev&)rev = repo.revLookup(str);
+    if (rev.ref) return rev;
+    
+    // Try to get a ref-backed rev (with skip parameter) by removing the ^ or ~ suffix from `str`
+    Rev skipRev;
+    {
+        std::string name(str);
+        size_t pos = name.find("^");
+        if (pos != std::string::npos) {
+            name.erase(pos);
+            (Git::Rev&)skipRev = repo.revLookup(name);
+        }
+    }
+    
+    if (!skipRev.ref) {
+        std::string name(str);
+        size_t pos = name.find("~");
+        if (pos != std::string::npos) {
+            name.erase(pos);
+            (Git::Rev&)skipRev = repo.revLookup(name);
+        }
+    }
+    
+    // If we found a `skipRev.ref` by removing the ^~ suffix, calculate the `skip` value
+    if (skipRev.ref) {
+        // Use generation numbers to stop as soon as `head` can no longer reach `rev.commit`,
+        // instead of walking to the root commit when `rev.commit` isn't a first-parent ancestor
+        Git::Ancestry& ancestry = Git::Ancestry::ForRepo(repo);
+        const Git::Ancestry::Pos target = ancestry.pos(rev.commit);
+        size_t skip = 0;
+        Git::Ancestry::Pos head = ancestry.pos(skipRev.commit);
+        while (head!=target && ancestry.reachable(target, head)) {
+            head = ancestry.parent(head);
+            skip++;
+        }
+        
+        if (head == target) {
+            skipRev.skip = skip;
+            return skipRev;
+        }
+    }
+    
+    // We couldn't parse `str` directly as a ref, nor could we parse it as "ref+skip" (ie rev^ / rev~X).
+    // So just return the commit itself.
+    return rev;
+}
+
 
 
 
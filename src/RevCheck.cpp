@@ -0,0 +1,173 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include "lib/toastbox/Defer.h"
+#include "git/Git.h"
+#include "Rev.h"
+#include "Check.h"
+
+// RevCheck: looks up revs of the form ref^ / ref~X via RevLookup(), and verifies that
+// they resolve to the ref with the expected `skip` value, both with and without a
+// commit-graph (including one written without generation numbers)
+// Invoked by `make check`; exits with a nonzero status on failure.
+
+enum class _Graph {
+    None,               // No commit-graph
+    Generations,        // Commit-graph with generation numbers
+    NoGenerations,      // Commit-graph without generation numbers (they're all 0)
+};
+
+struct _Case {
+    const char* str = nullptr;
+    const char* ref = nullptr; // Expected ref, or null if `str` should resolve to a bare commit
+    size_t skip = 0;
+};
+
+// The first-parent history of master is: m c5 c4 c3 c2 c1, where m merges `side` (s1),
+// which branched from c2
+static const _Case _Cases[] = {
+    { "master",     "master",   0 },
+    { "master^",    "master",   1 },
+    { "master~3",   "master",   3 },
+    { "master~5",   "master",   5 },
+    { "side~1",     "side",     1 },
+    // s1 isn't a first-parent ancestor of master, so it can't be represented as master+skip
+    { "master^2",   nullptr,    0 },
+};
+
+// _GenerationsClear(): zeroes the generation numbers in the commit-graph's commit data
+// chunk, like a commit-graph written by an implementation that doesn't compute them
+static void _GenerationsClear(const std::filesystem::path& path) {
+    constexpr uint32_t ChunkCommitData = 0x43444154; // "CDAT"
+    constexpr size_t CommitDataLen = GIT_OID_RAWSZ+16;
+    const auto read32 = [] (const uint8_t* x) {
+        return ((uint32_t)x[0]<<24) | ((uint32_t)x[1]<<16) | ((uint32_t)x[2]<<8) | (uint32_t)x[3];
+    };
+    const auto read64 = [&] (const uint8_t* x) {
+        return ((uint64_t)read32(x)<<32) | (uint64_t)read32(x+4);
+    };
+    
+    std::vector<uint8_t> data;
+    {
+        std::ifstream f(path, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    }
+    if (data.size() < 8) throw Toastbox::RuntimeError("commit-graph too small");
+    
+    bool found = false;
+    const size_t chunkCount = data[6];
+    for (size_t i=0; i<chunkCount; i++) {
+        const uint8_t* e = data.data() + 8 + i*12;
+        if (read32(e) != ChunkCommitData) continue;
+        const uint64_t off = read64(e+4);
+        const uint64_t end = read64(e+4+12);
+        for (uint64_t c=off; c+CommitDataLen<=end; c+=CommitDataLen) {
+            // The generation number occupies the high 30 bits; the low 2 bits belong to
+            // the commit time
+            uint8_t* g = data.data() + c + GIT_OID_RAWSZ + 8;
+            g[0] = 0;
+            g[1] = 0;
+            g[2] = 0;
+            g[3] &= 0x3;
+        }
+        found = true;
+    }
+    if (!found) throw Toastbox::RuntimeError("commit-graph has no CDAT chunk");
+    
+    std::filesystem::permissions(path, std::filesystem::perms::owner_write, std::filesystem::perm_options::add);
+    std::ofstream f(path, std::ios::binary|std::ios::trunc);
+    f.write((const char*)data.data(), data.size());
+    if (!f) throw Toastbox::RuntimeError("failed to write commit-graph");
+}
+
+// _RepoCreate(): creates the repository described above _Cases at `dir`
+static void _RepoCreate(const std::filesystem::path& dir, _Graph graph) {
+    Check::GitRun(dir.parent_path(), "init -q '" + dir.filename().string() + "'");
+    Check::GitRun(dir, "commit -q --allow-empty -m c1");
+    Check::GitRun(dir, "commit -q --allow-empty -m c2");
+    Check::GitRun(dir, "branch side");
+    Check::GitRun(dir, "commit -q --allow-empty -m c3");
+    Check::GitRun(dir, "commit -q --allow-empty -m c4");
+    Check::GitRun(dir, "commit -q --allow-empty -m c5");
+    Check::GitRun(dir, "checkout -q side");
+    Check::GitRun(dir, "commit -q --allow-empty -m s1");
+    Check::GitRun(dir, "checkout -q master");
+    Check::GitRun(dir, "merge -q --no-ff -m m side");
+    
+    if (graph != _Graph::None) {
+        Check::GitRun(dir, "-c commitGraph.generationVersion=1 commit-graph write --reachable");
+    }
+    
+    if (graph == _Graph::NoGenerations) {
+        _GenerationsClear(dir/".git"/"objects"/"info"/"commit-graph");
+    }
+}
+
+static void _Check(const std::filesystem::path& dir, _Graph graph) {
+    const Git::Repo repo = Git::Repo::Open(dir);
+    
+    // Verify that the commit-graph is in effect as intended
+    {
+        Git::Ancestry& ancestry = Git::Ancestry::ForRepo(repo);
+        const uint32_t g = ancestry.generation(ancestry.pos(repo.headResolved().commit));
+        const bool ok = (graph==_Graph::None          ? g==Git::Ancestry::GenerationInfinity :
+                         graph==_Graph::NoGenerations ? g==0 :
+                         g!=0 && g!=Git::Ancestry::GenerationInfinity);
+        if (!ok) throw Toastbox::RuntimeError("unexpected generation number for HEAD: %u", g);
+    }
+    
+    for (const _Case& c : _Cases) {
+        const Rev rev = RevLookup(repo, c.str);
+        const std::string id = Check::GitId(dir, c.str);
+        
+        if (c.ref) {
+            if (!rev.ref || rev.ref.name()!=c.ref || rev.skip!=c.skip) {
+                throw Toastbox::RuntimeError("%s: resolved to %s, expected %s~%zu",
+                    c.str, rev.displayName().c_str(), c.ref, c.skip);
+            }
+            
+            if (rev.displayHead().idStr() != id) {
+                throw Toastbox::RuntimeError("%s: display head is %s, expected %s",
+                    c.str, rev.displayHead().idStr().c_str(), id.c_str());
+            }
+        
+        } else if (rev.ref || rev.commit.idStr()!=id) {
+            throw Toastbox::RuntimeError("%s: resolved to %s, expected commit %s",
+                c.str, rev.displayName().c_str(), id.c_str());
+        }
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    try {
+        const Check::Env env("revcheck");
+        
+        git_libgit2_init();
+        Defer(git_libgit2_shutdown());
+        
+        // Each variant gets its own repository, since Ancestry is shared by every Repo
+        // handle to a given repository
+        const std::pair<_Graph,const char*> graphs[] = {
+            { _Graph::None,             "no commit-graph" },
+            { _Graph::Generations,      "commit-graph" },
+            { _Graph::NoGenerations,    "commit-graph without generation numbers" },
+        };
+        
+        for (const auto& [graph, name] : graphs) {
+            const std::filesystem::path dir = env.dir() / ("repo" + std::to_string((int)graph));
+            _RepoCreate(dir, graph);
+            try {
+                _Check(dir, graph);
+            } catch (const std::exception& e) {
+                throw Toastbox::RuntimeError("%s: %s", name, e.what());
+            }
+        }
+    
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+    
+    std::cout << "Revs resolved as expected\n";
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <iostream>
+#include <set>
+#include <thread>
+#include <mutex>
+#include "lib/toastbox/Defer.h"
+#include "git/Git.h"
+#include "Check.h"
+
+// SubmodulesCheck: updates a submodule that contains many nested submodules via
+// Repo::submodulesUpdate(), and verifies that every nested submodule was updated, and
+// that the nested submodules were updated by multiple threads
+// Invoked by `make check`; exits with a nonzero status on failure.
+
+static constexpr size_t _NestedCount = 40;
+
+int main(int argc, const char* argv[]) {
+    try {
+        const Check::Env env("submodulescheck");
+        const std::filesystem::path& dir = env.dir();
+        
+        const std::filesystem::path leaf = dir/"leaf";
+        const std::filesystem::path mid = dir/"mid";
+        const std::filesystem::path top = dir/"top";
+        
+        // mid: contains _NestedCount submodules of leaf
+        Check::GitRun(dir, "init -q leaf");
+        Check::GitRun(leaf, "commit -q --allow-empty -m leaf1");
+        Check::GitRun(dir, "init -q mid");
+        for (size_t i=0; i<_NestedCount; i++) {
+            Check::GitRun(mid, "submodule add -q '" + leaf.string() + "' n" + std::to_string(i));
+        }
+        Check::GitRun(mid, "commit -q -m mid1");
+        
+        // top: contains mid as a submodule, with every nested submodule checked out
+        Check::GitRun(dir, "init -q top");
+        Check::GitRun(top, "submodule add -q '" + mid.string() + "' mid");
+        Check::GitRun(top, "commit -q -m top1");
+        Check::GitRun(top, "submodule update -q --init --recursive");
+        
+        // Advance every nested submodule, and point top at the new mid, without updating
+        // top's nested submodules (like a checkout that doesn't recurse)
+        Check::GitRun(leaf, "commit -q --allow-empty -m leaf2");
+        Check::GitRun(mid, "submodule update -q --remote");
+        Check::GitRun(mid, "commit -q -a -m mid2");
+        Check::GitRun(top, "submodule update -q --remote mid");
+        Check::GitRun(top, "commit -q -a -m top2");
+        
+        std::mutex lock;
+        std::set<std::thread::id> threads;
+        {
+            git_libgit2_init();
+            Defer(git_libgit2_shutdown());
+            
+            const Git::Repo repo = Git::Repo::Open(top);
+            const Git::Commit commit = repo.headResolved().commit;
+            repo.submodulesUpdate(commit.parent().tree(), commit.tree(), true, [&] (size_t done, size_t total) {
+                auto l = std::unique_lock(lock);
+                threads.insert(std::this_thread::get_id());
+            });
+            
+            const std::string leafHead = Check::GitId(leaf, "HEAD");
+            for (size_t i=0; i<_NestedCount; i++) {
+                const std::filesystem::path nested = top/"mid"/("n" + std::to_string(i));
+                if (Check::GitId(nested, "HEAD") != leafHead) {
+                    throw Toastbox::RuntimeError("nested submodule wasn't updated: %s", nested.c_str());
+                }
+            }
+        }
+        
+        // The progress callback is called by whichever thread completed a task, so with
+        // _NestedCount tasks to spread across the pool, more than one thread should call it.
+        // (The pool size is bounded by the number of CPUs, so this can't be checked on a
+        // single-CPU machine.)
+        if (std::thread::hardware_concurrency() > 1) {
+            if (threads.size() < 2) throw Toastbox::RuntimeError("nested submodules weren't updated in parallel");
+            std::cout << "Submodules were updated by " << threads.size() << " threads\n";
+        } else {
+            std::cout << "Single CPU: skipping the parallelism check\n";
+        }
+    
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+    
+    std::cout << "Submodules were updated\n";
+    return 0;
+}
@@ -1,6 +1,13 @@
 #pragma once
 #include <algorithm>
 #include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace UTF8 {
 
@@ -59,34 +66,148 @@ inline T_Iter Prev(T_Iter it, T_Iter end) {
     return NextN(it, end, -1);
 }
 
-inline std::string TruncateHead(std::string_view str, size_t len) {
-    if (!len) return {};
-    // If the string _byte_ length is already less than `len` codepoints, then it's already truncated
-    if (str.size() <= len) return std::string(str);
-    
-    const size_t strLen = Len(str);
-    // If the string _codepoint_ length is already less than `len` codepoints, then it's already truncated
-    if (strLen <= len) return std::string(str);
-    
-    std::string r;
-    r.reserve(len); // Approximate space, assuming `str` is ASCII
-    
-    auto it = NextN(str.begin(), str.end(), strLen-len);
-    std::copy(it, str.end(), std::back_inserter(r));
-    return r;
+// AsciiPrefixLen(): returns the length of the run of ASCII bytes at the beginning of `str`
+// Text is overwhelmingly ASCII, so the run is found 16 (or 8) bytes at a time.
+inline size_t AsciiPrefixLen(std::string_view str) {
+    const char* const begin = str.data();
+    const char* const end = begin+str.size();
+    const char* p = begin;
+#if defined(__SSE2__)
+    for (; end-p >= 16; p+=16) {
+        const int nonAscii = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p));
+        if (nonAscii) return (p-begin) + __builtin_ctz(nonAscii);
+    }
+#endif
+    for (; end-p >= 8; p+=8) {
+        uint64_t x = 0;
+        memcpy(&x, p, sizeof(x));
+        if (x & 0x8080808080808080) break;
+    }
+    while (p!=end && !(*p & 0x80)) p++;
+    return p-begin;
 }
 
-inline std::string TruncateTail(std::string_view str, size_t len) {
-    if (!len) return {};
-    // If the string _byte_ length is already less than `len` codepoints, then it's already truncated
-    if (str.size() <= len) return std::string(str);
+// Decode(): decodes the codepoint at the beginning of `str`, returning its length in
+// bytes via `len`
+// Invalid sequences decode as the individual byte (U+FFFD if it's a lead byte, or
+// 0 if it's a stray continuation byte) so that partially-typed text can be measured.
+inline char32_t Decode(std::string_view str, size_t& len) {
+    const uint8_t b = str[0];
+    len = 1;
+    if (b < 0x80) return b;
+    if (!CodepointStart(b)) return 0;
     
-    std::string r;
-    r.reserve(len); // Approximate space, assuming `str` is ASCII
-    
-    auto it = NextN(str.begin(), str.end(), len);
-    std::copy(str.begin(), it, std::back_inserter(r));
-    return r;
+    const size_t seqLen = (b>=0xF0 ? 4 : (b>=0xE0 ? 3 : 2));
+    if (str.size() < seqLen) return 0xFFFD;
+    char32_t c = b & (0x7F >> seqLen);
+    for (size_t i=1; i<seqLen; i++) {
+        const uint8_t x = str[i];
+        if (CodepointStart(x)) return 0xFFFD;
+        c = (c<<6) | (x&0x3F);
+    }
+    len = seqLen;
+    return c;
+}
+
+// Encode(): appends the UTF-8 encoding of `c` to `str`
+inline void Encode(char32_t c, std::string& str) {
+    if (c < 0x80) {
+        str += (char)c;
+    } else if (c < 0x800) {
+        str += (char)(0xC0 | (c>>6));
+        str += (char)(0x80 | (c&0x3F));
+    } else if (c < 0x10000) {
+        str += (char)(0xE0 | (c>>12));
+        str += (char)(0x80 | ((c>>6)&0x3F));
+        str += (char)(0x80 | (c&0x3F));
+    } else {
+        str += (char)(0xF0 | (c>>18));
+        str += (char)(0x80 | ((c>>12)&0x3F));
+        str += (char)(0x80 | ((c>>6)&0x3F));
+        str += (char)(0x80 | (c&0x3F));
+    }
+}
+
+// CodepointWidth(): returns the number of terminal cells occupied by `c`, per wcwidth()
+// Codepoints that wcwidth() considers non-printable are assumed to occupy one cell.
+inline size_t CodepointWidth(char32_t c) {
+    if (c < 0x80) return 1;
+    const int w = wcwidth((wchar_t)c);
+    return (w>=0 ? (size_t)w : 1);
+}
+
+// _Width(): returns the byte length of the longest prefix of `str` that occupies
+// at most `widthMax` cells, and that prefix's width via `width`
+// Zero-width codepoints (eg combining marks) following the prefix are included.
+inline size_t _Width(std::string_view str, size_t widthMax, size_t& width) {
+    size_t off = 0;
+    width = 0;
+    while (off < str.size()) {
+        // ASCII fast path
+        const size_t ascii = std::min(AsciiPrefixLen(str.substr(off)), widthMax-width);
+        off += ascii;
+        width += ascii;
+        if (off==str.size() || width==widthMax) {
+            // Include zero-width codepoints that follow
+            while (off < str.size()) {
+                size_t len = 0;
+                const char32_t c = Decode(str.substr(off), len);
+                if (!c || c<0x80 || CodepointWidth(c)) break;
+                off += len;
+            }
+            break;
+        }
+        
+        size_t len = 0;
+        const char32_t c = Decode(str.substr(off), len);
+        const size_t w = (c ? CodepointWidth(c) : 0);
+        if (w > widthMax-width) break;
+        off += len;
+        width += w;
+    }
+    return off;
+}
+
+// Width(): returns the number of terminal cells occupied by `str`
+inline size_t Width(std::string_view str) {
+    size_t width = 0;
+    _Width(str, SIZE_MAX, width);
+    return width;
+}
+
+// WidthPrefixLen(): returns the byte length of the longest prefix of `str` that
+// occupies at most `width` cells
+inline size_t WidthPrefixLen(std::string_view str, size_t width) {
+    size_t w = 0;
+    return _Width(str, width, w);
+}
+
+// WidthSuffixOff(): returns the byte offset of the longest suffix of `str` that
+// occupies at most `width` cells
+inline size_t WidthSuffixOff(std::string_view str, size_t width) {
+    const size_t total = Width(str);
+    if (total <= width) return 0;
+    // Skip the fewest leading codepoints that cover the excess width
+    size_t skipped = 0;
+    size_t off = _Width(str, total-width, skipped);
+    while (skipped < total-width) {
+        size_t len = 0;
+        const char32_t c = Decode(str.substr(off), len);
+        skipped += (c ? CodepointWidth(c) : 0);
+        off += len;
+    }
+    // Skip zero-width codepoints attached to the last skipped codepoint
+    return off + WidthPrefixLen(str.substr(off), 0);
+}
+
+// TruncateHead(): returns the end of `str` that fits in `width` cells
+inline std::string TruncateHead(std::string_view str, size_t width) {
+    return std::string(str.substr(WidthSuffixOff(str, width)));
+}
+
+// TruncateTail(): returns the beginning of `str` that fits in `width` cells
+inline std::string TruncateTail(std::string_view str, size_t width) {
+    return std::string(str.substr(0, WidthPrefixLen(str, width)));
 }
 
 } // namespace UTF8
@@ -1,7 +1,7 @@
 constexpr const char*const UsageText = R"#(
 Usage:
 
-debase [<rev>...]
+debase [--low-bandwidth] [--frame-rate <fps>] [<rev>...]
     Open the specified git revisions in debase
 
     Supports standard git revision syntax, such as:
@@ -12,6 +12,14 @@ debase [<rev>...]
 
         git reflog | grep checkout:
 
+    With --low-bandwidth, debase only sends the parts of the screen
+    that changed, which reduces bandwidth when running remotely (eg
+    over SSH or mosh).
+
+    With --frame-rate, debase renders at most <fps> frames per second
+    (default: 60) while handling bursts of input, such as dragging.
+    Lowering it reduces bandwidth over slow connections.
+
 debase -h
 debase --help
     Print this help message
@@ -0,0 +1,317 @@
+#pragma once
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Git.h"
+#include "CommitInfo.h"
+
+namespace Git {
+
+// Ancestry: answers first-parent and generation-number queries for the commits of a
+// repository, without allocating a git_commit for every step of a walk.
+//
+// Commits are identified by a `Pos`. Commits contained in the repository's
+// commit-graph file (objects/info/commit-graph) occupy positions [0, graph.count),
+// and their parents/generation numbers are read directly from the memory-mapped file.
+// Commits that aren't in the commit-graph (eg because the graph is stale, or because
+// the repository doesn't have one) are read from the object database once and then
+// remembered in a flat cache that occupies positions [graph.count, ...). Commits that
+// are available from the CommitInfoArena's cache file don't need to be read at all.
+//
+// Commits are immutable, so one Ancestry is shared by all Repo handles that refer
+// to the same repository (see ForRepo()).
+class Ancestry : public RepoShared<Ancestry> {
+public:
+    using Pos = uint32_t;
+    static constexpr Pos PosNull = UINT32_MAX;
+    // Generation number of commits that aren't in the commit-graph, matching git's
+    // GENERATION_NUMBER_INFINITY semantics
+    static constexpr uint32_t GenerationInfinity = UINT32_MAX;
+    
+    static Ancestry& ForCommit(const Commit& commit) { return ForRepo(git_commit_owner(*commit)); }
+    
+    ~Ancestry() {
+        if (_graph.map) munmap((void*)_graph.map, _graph.mapLen);
+        git_odb_free(_odb);
+    }
+    
+    // pos(): returns the position of the commit with the given id
+    Pos pos(const Id& id) {
+        auto lock = std::unique_lock(_lock);
+        return _pos(id);
+    }
+    
+    Pos pos(const Commit& commit) {
+        if (!commit) return PosNull;
+        auto lock = std::unique_lock(_lock);
+        // Supply the commit itself so that we don't need to read it from the object
+        // database; it may not have been written to disk yet (see Mempack)
+        return _pos(commit.id(), *commit);
+    }
+    
+    // parent(): returns the position of the first parent of `p`, or PosNull if `p` is a root commit
+    Pos parent(Pos p) {
+        auto lock = std::unique_lock(_lock);
+        return _parent(p);
+    }
+    
+    // ancestor(): returns the position of the `n`th first-parent ancestor of `p`,
+    // or PosNull if the history ends first
+    Pos ancestor(Pos p, size_t n) {
+        auto lock = std::unique_lock(_lock);
+        while (p!=PosNull && n) {
+            p = _parent(p);
+            n--;
+        }
+        return p;
+    }
+    
+    Commit ancestor(const Commit& commit, size_t n) {
+        if (!commit || !n) return commit;
+        const Pos p = ancestor(pos(commit), n);
+        if (p == PosNull) return nullptr;
+        const Id i = id(p);
+        git_commit* x = nullptr;
+        int ir = git_commit_lookup(&x, git_commit_owner(*commit), &i);
+        if (ir) throw Error(ir, "git_commit_lookup failed");
+        return x;
+    }
+    
+    Id id(Pos p) {
+        auto lock = std::unique_lock(_lock);
+        if (p < _graph.count) return _graph.oids[p];
+        return _cache.entries.at(p-_graph.count).id;
+    }
+    
+    uint32_t generation(Pos p) {
+        if (p < _graph.count) return _GraphRead32(_graphCommitData(p)+GIT_OID_RAWSZ+8) >> 2;
+        return GenerationInfinity;
+    }
+    
+    // reachable(): returns false if `ancestor` is definitely not an ancestor of (or equal
+    // to) `descendant`, according to their generation numbers. A true return value means
+    // that `ancestor` may be reachable from `descendant`.
+    bool reachable(Pos ancestor, Pos descendant) {
+        if (ancestor == descendant) return true;
+        if (ancestor==PosNull || descendant==PosNull) return false;
+        const uint32_t ga = generation(ancestor);
+        const uint32_t gd = generation(descendant);
+        // Commit-graphs written without generation numbers store 0, which tells us nothing
+        if (!ga || !gd) return true;
+        // `descendant` isn't in the graph, so we can't bound its ancestry
+        if (gd == GenerationInfinity) return true;
+        // Commits in the graph never have parents outside of the graph
+        if (ga == GenerationInfinity) return false;
+        return ga < gd;
+    }
+    
+private:
+    static constexpr uint32_t _GraphSignature       = 0x43475048; // "CGPH"
+    static constexpr uint32_t _GraphChunkOIDFanout  = 0x4f494446; // "OIDF"
+    static constexpr uint32_t _GraphChunkOIDLookup  = 0x4f49444c; // "OIDL"
+    static constexpr uint32_t _GraphChunkCommitData = 0x43444154; // "CDAT"
+    static constexpr uint32_t _GraphParentNone      = 0x70000000;
+    static constexpr size_t _GraphHeaderLen         = 8;
+    static constexpr size_t _GraphChunkEntryLen     = 12;
+    static constexpr size_t _GraphCommitDataLen     = GIT_OID_RAWSZ+16;
+    
+    static uint32_t _GraphRead32(const uint8_t* x) {
+        return ((uint32_t)x[0]<<24) | ((uint32_t)x[1]<<16) | ((uint32_t)x[2]<<8) | (uint32_t)x[3];
+    }
+    
+    static uint64_t _GraphRead64(const uint8_t* x) {
+        return ((uint64_t)_GraphRead32(x)<<32) | (uint64_t)_GraphRead32(x+4);
+    }
+    
+    struct _CacheEntry {
+        Id id = {};
+        Id parentId = {};
+        bool root = false;
+        // Position of the first parent; resolved lazily because resolving it
+        // might require reading the parent from the object database
+        bool parentResolved = false;
+        Pos parent = PosNull;
+    };
+    
+    friend class RepoShared<Ancestry>;
+    
+    Ancestry(git_repository* repo) : _infos(CommitInfoArena::ForRepo(repo)) {
+        int ir = git_repository_odb(&_odb, repo);
+        if (ir) throw Error(ir, "git_repository_odb failed");
+        
+        // The commit-graph is purely an optimization, so if it's missing or we
+        // can't understand it, just fall back to the object database
+        const std::string path = std::string(git_repository_commondir(repo)) + "objects/info/commit-graph";
+        try {
+            _graphLoad(path);
+        } catch (...) {
+            if (_graph.map) munmap((void*)_graph.map, _graph.mapLen);
+            _graph = {};
+        }
+    }
+    
+    void _graphLoad(const std::string& path) {
+        const int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+        if (fd < 0) return; // No commit-graph
+        Defer(close(fd));
+        
+        struct stat st;
+        int ir = fstat(fd, &st);
+        if (ir) throw RuntimeError("fstat failed: %s", strerror(errno));
+        const size_t len = (size_t)st.st_size;
+        if (len < _GraphHeaderLen) throw RuntimeError("commit-graph too small");
+        
+        void* map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) throw RuntimeError("mmap failed: %s", strerror(errno));
+        _graph.map = (const uint8_t*)map;
+        _graph.mapLen = len;
+        
+        const uint8_t* h = _graph.map;
+        if (_GraphRead32(h) != _GraphSignature) throw RuntimeError("invalid commit-graph signature");
+        if (h[4] != 1) throw RuntimeError("unsupported commit-graph version");
+        if (h[5] != 1) throw RuntimeError("unsupported commit-graph hash version");
+        const size_t chunkCount = h[6];
+        // Graphs that depend on base graphs only exist as part of a commit-graph chain
+        if (h[7] != 0) throw RuntimeError("commit-graph has base graphs");
+        
+        const uint8_t* fanout = nullptr;
+        const uint8_t* oids = nullptr;
+        const uint8_t* commitData = nullptr;
+        size_t commitDataLen = 0;
+        size_t oidsLen = 0;
+        if (len < _GraphHeaderLen + (chunkCount+1)*_GraphChunkEntryLen) throw RuntimeError("commit-graph too small");
+        for (size_t i=0; i<chunkCount; i++) {
+            const uint8_t* e = h + _GraphHeaderLen + i*_GraphChunkEntryLen;
+            const uint32_t chunkId = _GraphRead32(e);
+            const uint64_t off = _GraphRead64(e+4);
+            const uint64_t end = _GraphRead64(e+4+_GraphChunkEntryLen);
+            if (off>end || end>len) throw RuntimeError("invalid commit-graph chunk offset");
+            switch (chunkId) {
+            case _GraphChunkOIDFanout:  fanout = h+off; if (end-off != 256*4) throw RuntimeError("invalid OIDF chunk"); break;
+            case _GraphChunkOIDLookup:  oids = h+off; oidsLen = end-off; break;
+            case _GraphChunkCommitData: commitData = h+off; commitDataLen = end-off; break;
+            }
+        }
+        
+        if (!fanout || !oids || !commitData) throw RuntimeError("commit-graph missing required chunks");
+        const size_t count = _GraphRead32(fanout+255*4);
+        if (oidsLen != count*GIT_OID_RAWSZ) throw RuntimeError("invalid OIDL chunk");
+        if (commitDataLen != count*_GraphCommitDataLen) throw RuntimeError("invalid CDAT chunk");
+        if (count >= _GraphParentNone) throw RuntimeError("commit-graph too large");
+        
+        _graph.fanout = fanout;
+        _graph.oids = (const Id*)oids;
+        _graph.commitData = commitData;
+        _graph.count = (Pos)count;
+    }
+    
+    const uint8_t* _graphCommitData(Pos p) const {
+        return _graph.commitData + (size_t)p*_GraphCommitDataLen;
+    }
+    
+    Pos _graphFind(const Id& id) const {
+        if (!_graph.count) return PosNull;
+        const uint8_t b = id.id[0];
+        Pos lo = (b ? _GraphRead32(_graph.fanout+(b-1)*4) : 0);
+        Pos hi = _GraphRead32(_graph.fanout+b*4);
+        while (lo < hi) {
+            const Pos mid = lo + (hi-lo)/2;
+            const int cmp = git_oid_cmp(&_graph.oids[mid], &id);
+            if (!cmp) return mid;
+            if (cmp < 0) lo = mid+1;
+            else         hi = mid;
+        }
+        return PosNull;
+    }
+    
+    Pos _pos(const Id& id, const git_commit* commit=nullptr) {
+        // Check the commit-graph
+        if (const Pos p=_graphFind(id); p!=PosNull) return p;
+        
+        // Check the flat cache
+        if (auto it=_cache.positions.find(id); it!=_cache.positions.end()) return it->second;
+        
+        // Add the commit to the cache, reading it from the object database if we weren't
+        // given it and it isn't in the CommitInfo cache
+        _CacheEntry e = { .id = id };
+        if (commit) {
+            if (git_commit_parentcount(commit)) e.parentId = *git_commit_parent_id(commit, 0);
+            else                                e.root = true;
+        
+        } else if (const CommitInfo* info = _infos.cached(id)) {
+            if (info->parentCount) e.parentId = info->parents[0];
+            else                   e.root = true;
+        
+        } else {
+            git_odb_object* obj = nullptr;
+            int ir = git_odb_read(&obj, _odb, &id);
+            if (ir) throw Error(ir, "git_odb_read failed");
+            Defer(git_odb_object_free(obj));
+            if (git_odb_object_type(obj) != GIT_OBJECT_COMMIT) throw RuntimeError("object isn't a commit");
+            
+            // Commit headers start with the `tree` line, followed by the `parent` lines
+            constexpr std::string_view ParentPrefix = "parent ";
+            const std::string_view data((const char*)git_odb_object_data(obj), git_odb_object_size(obj));
+            const size_t lineEnd = data.find('\n');
+            const std::string_view parentLine = (lineEnd!=std::string_view::npos ? data.substr(lineEnd+1) : std::string_view());
+            if (parentLine.substr(0, ParentPrefix.size()) == ParentPrefix &&
+                parentLine.size() >= ParentPrefix.size()+GIT_OID_HEXSZ) {
+                ir = git_oid_fromstrn(&e.parentId, parentLine.data()+ParentPrefix.size(), GIT_OID_HEXSZ);
+                if (ir) throw Error(ir, "git_oid_fromstrn failed");
+            } else {
+                e.root = true;
+            }
+        }
+        
+        const Pos p = _graph.count + (Pos)_cache.entries.size();
+        _cache.entries.push_back(e);
+        _cache.positions[id] = p;
+        return p;
+    }
+    
+    Pos _parent(Pos p) {
+        assert(p != PosNull);
+        if (p < _graph.count) {
+            const Pos parent = _GraphRead32(_graphCommitData(p)+GIT_OID_RAWSZ);
+            if (parent == _GraphParentNone) return PosNull;
+            if (parent >= _graph.count) throw RuntimeError("invalid commit-graph parent");
+            return parent;
+        }
+        
+        // Don't hold a reference to the entry across _pos(), which may grow `entries`
+        const size_t idx = p-_graph.count;
+        if (!_cache.entries.at(idx).parentResolved) {
+            const _CacheEntry& e = _cache.entries[idx];
+            const Pos parent = (e.root ? PosNull : _pos(Id(e.parentId)));
+            _cache.entries[idx].parent = parent;
+            _cache.entries[idx].parentResolved = true;
+        }
+        return _cache.entries[idx].parent;
+    }
+    
+    std::mutex _lock;
+    git_odb* _odb = nullptr;
+    CommitInfoArena& _infos;
+    
+    struct {
+        const uint8_t* map = nullptr;
+        size_t mapLen = 0;
+        const uint8_t* fanout = nullptr;
+        const Id* oids = nullptr;
+        const uint8_t* commitData = nullptr;
+        Pos count = 0;
+    } _graph;
+    
+    struct {
+        std::vector<_CacheEntry> entries;
+        std::unordered_map<Id,Pos,IdHash,IdEqual> positions;
+    } _cache;
+};
+
+} // namespace Git
@@ -0,0 +1,414 @@
+#pragma once
+#include <mutex>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Git.h"
+
+namespace Git {
+
+// CommitInfo: the parts of a commit that the UI displays
+// CommitInfos are owned by a CommitInfoArena, and their strings/parents point into the
+// arena, so they're only valid for the arena's lifetime (ie the process's lifetime).
+struct CommitInfo {
+    Id id = {};
+    Time time;
+    std::string_view author;
+    // summary: the beginning of the commit message; enough to display its first
+    // SummaryLineCountMax lines
+    std::string_view summary;
+    const Id* parents = nullptr;
+    size_t parentCount = 0;
+    
+    bool isMerge() const { return parentCount > 1; }
+};
+
+// CommitInfoArena: reads and remembers the CommitInfo for commits of a repository
+//
+// Each commit is read from the object database once, without creating a git_commit,
+// and its CommitInfo is stored in a flat arena that only grows, so CommitInfo references
+// remain valid. The storage for a commit doesn't depend on the size of its message,
+// since only its summary is kept.
+//
+// CommitInfos can also be persisted to a cache file (see cacheOpen()/cacheWrite()),
+// which is memory-mapped and searched in place, so that commits seen by a previous
+// session are displayed without reading the object database at all.
+//
+// Like Ancestry, one CommitInfoArena is shared by all Repo handles that refer to the
+// same repository (see ForRepo()).
+class CommitInfoArena : public RepoShared<CommitInfoArena> {
+public:
+    static constexpr size_t SummaryLineCountMax = 2;
+    
+    ~CommitInfoArena() {
+        if (_cache.map) munmap((void*)_cache.map, _cache.mapLen);
+        git_odb_free(_odb);
+    }
+    
+    // info(): returns the CommitInfo for the commit with the given id
+    const CommitInfo& info(const Id& id) {
+        auto lock = std::unique_lock(_lock);
+        if (const CommitInfo* info=_cached(id)) return *info;
+        
+        git_odb_object* obj = nullptr;
+        int ir = git_odb_read(&obj, _odb, &id);
+        if (ir) throw Error(ir, "git_odb_read failed");
+        Defer(git_odb_object_free(obj));
+        if (git_odb_object_type(obj) != GIT_OBJECT_COMMIT) throw RuntimeError("object isn't a commit");
+        
+        const std::string_view data((const char*)git_odb_object_data(obj), git_odb_object_size(obj));
+        CommitInfo& info = _entries.emplace_back(_parse(data));
+        info.id = id;
+        _infos[id] = &info;
+        _cacheStale = true;
+        return info;
+    }
+    
+    // cached(): returns the CommitInfo for the commit with the given id if it's
+    // available without reading the object database, otherwise null
+    const CommitInfo* cached(const Id& id) {
+        auto lock = std::unique_lock(_lock);
+        return _cached(id);
+    }
+    
+    // cacheOpen(): maps the cache file at `path`, which info() consults before the
+    // object database, and which cacheWrite() updates
+    // The cache is purely an optimization, so a missing or invalid file is ignored.
+    void cacheOpen(const std::filesystem::path& path) {
+        auto lock = std::unique_lock(_lock);
+        if (!_cache.path.empty()) return;
+        _cache.path = path;
+        try {
+            _cacheLoad();
+        } catch (...) {
+            if (_cache.map) munmap((void*)_cache.map, _cache.mapLen);
+            _cache = { .path = path };
+        }
+    }
+    
+    // cacheWrite(): rewrites the cache file to contain the entries that were read
+    // from the object database since cacheOpen()
+    // Failing to write the cache isn't an error, so I/O errors are ignored.
+    void cacheWrite() {
+        auto lock = std::unique_lock(_lock);
+        if (_cache.path.empty() || !_cacheStale) return;
+        
+        // Carry over the entries of the existing file, unless that would make it too
+        // large, in which case only the entries used by this session are kept
+        std::vector<CommitInfo> carried;
+        if (_cache.count+_infos.size() <= _CacheEntryCountMax) {
+            for (size_t i=0; i<_cache.count; i++) {
+                const std::optional<CommitInfo> info = _cacheInfo(i);
+                if (info && _infos.find(info->id)==_infos.end()) carried.push_back(*info);
+            }
+        }
+        
+        std::vector<const CommitInfo*> infos;
+        for (const CommitInfo& info : carried) infos.push_back(&info);
+        for (const auto& [id, info] : _infos) infos.push_back(info);
+        std::sort(infos.begin(), infos.end(), [] (const CommitInfo* a, const CommitInfo* b) {
+            return git_oid_cmp(&a->id, &b->id) < 0;
+        });
+        
+        std::vector<_CacheRecord> records;
+        std::string blob;
+        for (const CommitInfo* info : infos) {
+            _CacheRecord& rec = records.emplace_back();
+            rec.id = info->id;
+            rec.time = info->time.time;
+            rec.timeOffset = info->time.offset;
+            rec.parentCount = (uint32_t)info->parentCount;
+            rec.parentsOff = (uint32_t)blob.size();
+            blob.append((const char*)info->parents, info->parentCount*sizeof(Id));
+            rec.authorOff = (uint32_t)blob.size();
+            rec.authorLen = (uint32_t)info->author.size();
+            blob += info->author;
+            rec.summaryOff = (uint32_t)blob.size();
+            rec.summaryLen = (uint32_t)info->summary.size();
+            blob += info->summary;
+        }
+        
+        const _CacheHeader header = {
+            .signature = _CacheSignature,
+            .version = _CacheVersion,
+            .count = (uint32_t)records.size(),
+        };
+        
+        // Write to a temporary file and rename it into place, so that concurrent
+        // sessions never see a partially-written cache. Our own mapping of the
+        // previous file remains valid.
+        std::error_code ec;
+        std::filesystem::create_directories(_cache.path.parent_path(), ec);
+        const std::filesystem::path tmp = _cache.path.string() + "." + std::to_string(getpid());
+        {
+            std::ofstream f(tmp, std::ios::binary|std::ios::trunc);
+            f.write((const char*)&header, sizeof(header));
+            f.write((const char*)records.data(), records.size()*sizeof(_CacheRecord));
+            f.write(blob.data(), blob.size());
+            if (!f) {
+                std::filesystem::remove(tmp, ec);
+                return;
+            }
+        }
+        std::filesystem::rename(tmp, _cache.path, ec);
+        if (ec) std::filesystem::remove(tmp, ec);
+        _cacheStale = false;
+    }
+
+private:
+    // Messages are truncated to this length, which is far more than fits in
+    // SummaryLineCountMax wrapped lines
+    static constexpr size_t _SummaryLenMax = 512;
+    static constexpr size_t _BlockLen = 64*1024;
+    
+    static constexpr uint32_t _CacheSignature = 0x49434244; // 'DBCI'
+    static constexpr uint32_t _CacheVersion = 2;
+    static constexpr size_t _CacheEntryCountMax = 200000;
+    
+    // Cache file layout:
+    //   _CacheHeader
+    //   _CacheRecord[count], sorted by id
+    //   blob: parent ids and strings, referenced by offset from the records
+    struct _CacheHeader {
+        uint32_t signature = 0;
+        uint32_t version = 0;
+        uint32_t count = 0;
+        uint32_t reserved = 0;
+    };
+    
+    struct _CacheRecord {
+        Id id = {};
+        uint32_t parentCount = 0;
+        int64_t time = 0;
+        int32_t timeOffset = 0;
+        uint32_t parentsOff = 0;
+        uint32_t authorOff = 0;
+        uint32_t authorLen = 0;
+        uint32_t summaryOff = 0;
+        uint32_t summaryLen = 0;
+    };
+    static_assert(sizeof(_CacheRecord) == 56);
+    
+    friend class RepoShared<CommitInfoArena>;
+    
+    CommitInfoArena(git_repository* repo) {
+        int ir = git_repository_odb(&_odb, repo);
+        if (ir) throw Error(ir, "git_repository_odb failed");
+    }
+    
+    const CommitInfo* _cached(const Id& id) {
+        if (auto it=_infos.find(id); it!=_infos.end()) return it->second;
+        
+        // Binary search the cache file
+        size_t lo = 0;
+        size_t hi = _cache.count;
+        while (lo < hi) {
+            const size_t mid = lo + (hi-lo)/2;
+            const int cmp = git_oid_cmp(&_cache.records[mid].id, &id);
+            if (!cmp) {
+                const std::optional<CommitInfo> info = _cacheInfo(mid);
+                if (!info) return nullptr;
+                CommitInfo& x = _entries.emplace_back(*info);
+                _infos[id] = &x;
+                return &x;
+            }
+            if (cmp < 0) lo = mid+1;
+            else         hi = mid;
+        }
+        return nullptr;
+    }
+    
+    void _cacheLoad() {
+        const int fd = open(_cache.path.c_str(), O_RDONLY|O_CLOEXEC);
+        if (fd < 0) return; // No cache
+        Defer(close(fd));
+        
+        struct stat st;
+        int ir = fstat(fd, &st);
+        if (ir) throw RuntimeError("fstat failed: %s", strerror(errno));
+        const size_t len = (size_t)st.st_size;
+        if (len < sizeof(_CacheHeader)) throw RuntimeError("cache too small");
+        
+        void* map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) throw RuntimeError("mmap failed: %s", strerror(errno));
+        _cache.map = (const uint8_t*)map;
+        _cache.mapLen = len;
+        
+        const _CacheHeader& header = *(const _CacheHeader*)_cache.map;
+        if (header.signature != _CacheSignature) throw RuntimeError("invalid cache signature");
+        if (header.version != _CacheVersion) throw RuntimeError("unsupported cache version");
+        const size_t recordsLen = (size_t)header.count*sizeof(_CacheRecord);
+        if (len-sizeof(_CacheHeader) < recordsLen) throw RuntimeError("cache too small");
+        
+        _cache.records = (const _CacheRecord*)(_cache.map+sizeof(_CacheHeader));
+        _cache.count = header.count;
+        _cache.blob = (const char*)(_cache.map+sizeof(_CacheHeader)+recordsLen);
+        _cache.blobLen = len-sizeof(_CacheHeader)-recordsLen;
+    }
+    
+    // _cacheInfo(): returns the CommitInfo for the cache file's record at index `i`,
+    // referencing the mapped file, or nullopt if the record is invalid
+    std::optional<CommitInfo> _cacheInfo(size_t i) const {
+        const _CacheRecord& rec = _cache.records[i];
+        const auto valid = [&] (uint32_t off, size_t len) {
+            return off<=_cache.blobLen && len<=_cache.blobLen-off;
+        };
+        if (!valid(rec.parentsOff, (size_t)rec.parentCount*sizeof(Id)) ||
+            !valid(rec.authorOff, rec.authorLen) ||
+            !valid(rec.summaryOff, rec.summaryLen)) return std::nullopt;
+        
+        CommitInfo info;
+        info.id = rec.id;
+        info.time = { .time = (time_t)rec.time, .offset = rec.timeOffset };
+        info.author = {_cache.blob+rec.authorOff, rec.authorLen};
+        info.summary = {_cache.blob+rec.summaryOff, rec.summaryLen};
+        info.parents = (rec.parentCount ? (const Id*)(_cache.blob+rec.parentsOff) : nullptr);
+        info.parentCount = rec.parentCount;
+        return info;
+    }
+    
+    // _parse(): parses a raw commit object, which consists of header lines (`tree`,
+    // `parent`, `author`, etc), followed by an empty line and the message
+    CommitInfo _parse(std::string_view data) {
+        constexpr std::string_view ParentPrefix = "parent ";
+        constexpr std::string_view AuthorPrefix = "author ";
+        
+        CommitInfo info;
+        std::vector<Id> parents;
+        std::string_view msg;
+        for (;;) {
+            const size_t lineEnd = data.find('\n');
+            const std::string_view line = data.substr(0, lineEnd);
+            data = (lineEnd!=std::string_view::npos ? data.substr(lineEnd+1) : std::string_view());
+            
+            // End of header
+            if (line.empty()) {
+                msg = data;
+                break;
+            }
+            
+            if (line.substr(0, ParentPrefix.size()) == ParentPrefix) {
+                Id& id = parents.emplace_back();
+                const std::string_view hex = line.substr(ParentPrefix.size());
+                int ir = git_oid_fromstrn(&id, hex.data(), std::min(hex.size(), (size_t)GIT_OID_HEXSZ));
+                if (ir) throw Error(ir, "git_oid_fromstrn failed");
+            
+            } else if (line.substr(0, AuthorPrefix.size()) == AuthorPrefix) {
+                _authorParse(line.substr(AuthorPrefix.size()), info);
+            }
+            
+            if (data.empty()) break;
+        }
+        
+        if (!parents.empty()) {
+            Id* p = (Id*)_alloc(parents.size()*sizeof(Id), alignof(Id));
+            std::copy(parents.begin(), parents.end(), p);
+            info.parents = p;
+            info.parentCount = parents.size();
+        }
+        
+        info.summary = _strCopy(_Summary(msg));
+        return info;
+    }
+    
+    // _authorParse(): parses a signature of the form:
+    //   <name> <<email>> <time> <tz>
+    void _authorParse(std::string_view sig, CommitInfo& info) {
+        const size_t emailStart = sig.find(" <");
+        const size_t emailEnd = sig.rfind("> ");
+        if (emailStart==std::string_view::npos || emailEnd==std::string_view::npos) return;
+        
+        info.author = _strCopy(sig.substr(0, emailStart));
+        
+        const std::string_view when = sig.substr(emailEnd+2);
+        const size_t space = when.find(' ');
+        info.time.time = (time_t)strtoll(std::string(when.substr(0, space)).c_str(), nullptr, 10);
+        if (space != std::string_view::npos) {
+            const std::string_view tz = when.substr(space+1);
+            if (tz.size()==5 && (tz[0]=='+' || tz[0]=='-')) {
+                const int hhmm = atoi(std::string(tz.substr(1)).c_str());
+                const int offset = (hhmm/100)*60 + (hhmm%100);
+                info.time.offset = (tz[0]=='-' ? -offset : offset);
+            }
+        }
+    }
+    
+    // _Summary(): returns the beginning of `msg` that contains its first SummaryLineCountMax
+    // non-empty lines, up to _SummaryLenMax bytes
+    // Leading newlines are skipped, like git_commit_message() does.
+    static std::string_view _Summary(std::string_view msg) {
+        msg.remove_prefix(std::min(msg.find_first_not_of('\n'), msg.size()));
+        size_t len = 0;
+        size_t lineCount = 0;
+        while (len<msg.size() && lineCount<SummaryLineCountMax) {
+            const size_t lineEnd = std::min(msg.find('\n', len), msg.size());
+            if (lineEnd != len) lineCount++;
+            len = std::min(lineEnd+1, msg.size());
+        }
+        
+        if (len > _SummaryLenMax) {
+            len = _SummaryLenMax;
+            // Don't split a UTF-8 sequence
+            while (len && ((uint8_t)msg[len]&0xC0)==0x80) len--;
+        }
+        return msg.substr(0, len);
+    }
+    
+    std::string_view _strCopy(std::string_view str) {
+        if (str.empty()) return {};
+        char* p = (char*)_alloc(str.size(), 1);
+        memcpy(p, str.data(), str.size());
+        return {p, str.size()};
+    }
+    
+    // _alloc(): returns storage from the arena, which is never freed or moved
+    void* _alloc(size_t len, size_t align) {
+        _blockOff = (_blockOff+align-1) & ~(align-1);
+        if (_blockOff+len > _BlockLen) {
+            // Large allocations get their own block
+            if (len > _BlockLen) {
+                return _blocks.emplace_back(new uint8_t[len]).get();
+            }
+            
+            _block = _blocks.emplace_back(new uint8_t[_BlockLen]).get();
+            _blockOff = 0;
+        }
+        
+        void* r = _block+_blockOff;
+        _blockOff += len;
+        return r;
+    }
+    
+    std::mutex _lock;
+    git_odb* _odb = nullptr;
+    std::vector<std::unique_ptr<uint8_t[]>> _blocks;
+    uint8_t* _block = nullptr;
+    size_t _blockOff = _BlockLen;
+    std::deque<CommitInfo> _entries;
+    std::unordered_map<Id,const CommitInfo*,IdHash,IdEqual> _infos;
+    
+    struct {
+        std::filesystem::path path;
+        const uint8_t* map = nullptr;
+        size_t mapLen = 0;
+        const _CacheRecord* records = nullptr;
+        size_t count = 0;
+        const char* blob = nullptr;
+        size_t blobLen = 0;
+    } _cache;
+    // Whether entries were read from the object database since the cache file was written
+    bool _cacheStale = false;
+};
+
+} // namespace Git
@@ -4,12 +4,25 @@
 #include <vector>
 #include <cassert>
 #include <cstring>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "Debase.h"
 #include "RefCounted.h"
 #include "lib/toastbox/RuntimeError.h"
 #include "lib/toastbox/Defer.h"
 #include "lib/toastbox/String.h"
 #include "lib/libgit2/include/git2.h"
+#include "lib/libgit2/include/git2/sys/repository.h"
 
 namespace Git {
 using namespace Toastbox;
@@ -76,6 +89,20 @@ inline std::string DisplayStringForId(const git_oid& oid, size_t len) {
     return str;
 }
 
+// IdHash / IdEqual: allow Ids to be used as keys of unordered containers
+// Ids are SHA-1 hashes, so their leading bytes are already uniformly distributed.
+struct IdHash {
+    size_t operator()(const Id& id) const {
+        size_t x = 0;
+        memcpy(&x, id.id, sizeof(x));
+        return x;
+    }
+};
+
+struct IdEqual {
+    bool operator()(const Id& a, const Id& b) const { return git_oid_equal(&a, &b); }
+};
+
 static const char* _Weekdays[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat", };
 static const char* _Months[]   = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec", };
 
@@ -174,6 +201,7 @@ inline Time TimeFromString(const std::string& str) {
 }
 
 using Tree = RefCounted<git_tree*, git_tree_free>;
+using Odb = RefCounted<git_odb*, git_odb_free>;
 
 static void _MergeFileResultFree(git_merge_file_result& x) {
     git_merge_file_result_free(&x);
@@ -339,6 +367,22 @@ struct Commit : Object {
     }
 };
 
+} // namespace Git
+
+// std::less<Git::Commit>: allows sets/maps of commits, which are ordered by id, to be
+// searched by id without having to look up the commit first
+template <>
+struct std::less<Git::Commit> {
+    using is_transparent = void;
+    
+    bool operator()(const Git::Commit& a, const Git::Commit& b) const { return a < b; }
+    // Null commits order first
+    bool operator()(const Git::Commit& a, const Git::Id& b) const { return !a || git_oid_cmp(&a.id(), &b)<0; }
+    bool operator()(const Git::Id& a, const Git::Commit& b) const { return b && git_oid_cmp(&a, &b.id())<0; }
+};
+
+namespace Git {
+
 struct Blob : Object {
     using Object::Object;
     Blob(const git_blob* x) : Object((git_object*)x) {}
@@ -588,10 +632,15 @@ public:
 struct Reflog : RefCounted<git_reflog*, git_reflog_free> {
     using RefCounted::RefCounted;
     
-    void append(const Signature& sig, const Rev& curr, const Rev& next) const {
+    // CheckoutMessage(): returns the message of a reflog entry for checking out `next`
+    static std::string CheckoutMessage(const Rev& curr, const Rev& next) {
         const std::string currName = (curr.ref ? curr.ref.name() : curr.commit.idStr());
         const std::string nextName = (next.ref ? next.ref.name() : next.commit.idStr());
-        const std::string msg = "checkout: moving from " + currName + " to " + nextName;
+        return "checkout: moving from " + currName + " to " + nextName;
+    }
+    
+    void append(const Signature& sig, const Rev& curr, const Rev& next) const {
+        const std::string msg = CheckoutMessage(curr, next);
         int ir = git_reflog_append(*get(), &next.commit.id(), *sig, msg.c_str());
         if (ir) throw Error(ir, "git_reflog_append failed");
         ir = git_reflog_write(*get());
@@ -621,6 +670,94 @@ struct Reflog : RefCounted<git_reflog*, git_reflog_free> {
     }
 };
 
+// ReflogTail: reads a reflog from its newest entry to its oldest, by memory-mapping the
+// log file and scanning backward from its end. Unlike Reflog, which parses every entry
+// up front, only the entries that are visited are parsed, so finding the most recent
+// entries is cheap regardless of the reflog's length.
+class ReflogTail {
+public:
+    struct Entry {
+        Id idOld;
+        Id idNew;
+        // Points into the mapped log file, so it's only valid for the ReflogTail's lifetime
+        std::string_view message;
+    };
+    
+    ReflogTail() {}
+    
+    ReflogTail(const std::filesystem::path& path) {
+        const int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+        if (fd < 0) {
+            // A missing reflog is equivalent to an empty one
+            if (errno == ENOENT) return;
+            throw RuntimeError("open failed: %s", strerror(errno));
+        }
+        Defer(close(fd));
+        
+        struct stat st;
+        int ir = fstat(fd, &st);
+        if (ir) throw RuntimeError("fstat failed: %s", strerror(errno));
+        const size_t len = (size_t)st.st_size;
+        if (!len) return;
+        
+        void* map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) throw RuntimeError("mmap failed: %s", strerror(errno));
+        _map = (const char*)map;
+        _mapLen = len;
+        _off = len;
+    }
+    
+    ~ReflogTail() {
+        if (_map) munmap((void*)_map, _mapLen);
+    }
+    
+    ReflogTail(const ReflogTail&) = delete;
+    ReflogTail& operator=(const ReflogTail&) = delete;
+    
+    // next(): returns the next-oldest entry, or nullopt if there are no more entries
+    // Malformed entries are skipped.
+    std::optional<Entry> next() {
+        while (_off) {
+            // Find the start of the line ending at `_off`, ignoring its trailing newline
+            size_t end = _off;
+            if (_map[end-1] == '\n') end--;
+            // Scan backwards for the preceding newline (memrchr() isn't available on macOS)
+            size_t start = end;
+            while (start && _map[start-1]!='\n') start--;
+            _off = start;
+            
+            if (std::optional<Entry> e = _EntryParse({_map+start, end-start})) {
+                return e;
+            }
+        }
+        return std::nullopt;
+    }
+    
+private:
+    // _EntryParse(): parses a reflog line, which has the form:
+    //   <old id> <new id> <name> <<email>> <time> <tz>\t<message>
+    static std::optional<Entry> _EntryParse(std::string_view line) {
+        constexpr size_t IdLen = GIT_OID_HEXSZ;
+        if (line.size()<IdLen*2+2 || line[IdLen]!=' ' || line[IdLen*2+1]!=' ') return std::nullopt;
+        
+        Entry e;
+        if (git_oid_fromstrn(&e.idOld, line.data(), IdLen)) return std::nullopt;
+        if (git_oid_fromstrn(&e.idNew, line.data()+IdLen+1, IdLen)) return std::nullopt;
+        
+        const size_t tab = line.find('\t');
+        if (tab != std::string_view::npos) e.message = line.substr(tab+1);
+        return e;
+    }
+    
+    const char* _map = nullptr;
+    size_t _mapLen = 0;
+    size_t _off = 0; // Offset of the end of the next entry to be returned
+};
+
+struct Transaction : RefCounted<git_transaction*, git_transaction_free> {
+    using RefCounted::RefCounted;
+};
+
 inline void _RepoFree(git_repository* repo) {
     git_repository_free(repo);
     git_libgit2_shutdown(); // Balance call in Repo::Open()
@@ -678,6 +815,23 @@ public:
         return x;
     }
     
+    // reopen(): returns a new handle to the same repository that shares our object database
+    // Repo handles can't be used by multiple threads simultaneously, so this allows work to
+    // be performed on the repository concurrently, while any objects written by one handle
+    // (eg to an in-memory object database) are visible to the others.
+    Repo reopen() const {
+        Repo repo = _OpenDir(git_repository_path(*get()));
+        
+        git_odb* odb = nullptr;
+        int ir = git_repository_odb(&odb, *get());
+        if (ir) throw Error(ir, "git_repository_odb failed");
+        Defer(git_odb_free(odb));
+        
+        ir = git_repository_set_odb(*repo, odb);
+        if (ir) throw Error(ir, "git_repository_set_odb failed");
+        return repo;
+    }
+    
     std::filesystem::path path() const {
         return git_repository_workdir(*get());
     }
@@ -705,9 +859,10 @@ public:
         // false (because git doesn't allow HEAD to point to tags currently --
         // instead it's a detached HEAD).
         try {
-            Reflog reflog = reflogForRef(head());
-            const git_reflog_entry*const entry = reflog.at(0);
-            const Rev rev = reflogRevForCheckoutEntry(entry);
+            ReflogTail reflog = reflogTailForRef(head());
+            const std::optional<ReflogTail::Entry> entry = reflog.next();
+            if (!entry) throw std::out_of_range("reflog empty");
+            const Rev rev = reflogRevForCheckoutEntry(*entry);
             if (rev.ref && rev.commit==ref.commit()) {
                 return rev;
             }
@@ -716,7 +871,19 @@ public:
         return ref.commit();
     }
     
-    void checkout(const Rev& rev) const {
+    // SubmodulesProgress: called with the number of submodules updated so far, and the
+    // number of submodules found to need updating so far
+    using SubmodulesProgress = std::function<void(size_t done, size_t total)>;
+    
+    // headTree(): returns the tree of HEAD's commit, or null if the current branch is unborn
+    Tree headTree() const {
+        git_object* x = nullptr;
+        int ir = git_revparse_single(&x, *get(), "HEAD^{tree}");
+        if (ir) return nullptr;
+        return (git_tree*)x;
+    }
+    
+    void checkout(const Rev& rev, const SubmodulesProgress& progress=nullptr) const {
         struct Ctx {
             std::vector<std::filesystem::path> conflicts;
         };
@@ -740,7 +907,11 @@ public:
             return 0;
         };
         
-        int ir = git_checkout_tree(*get(), (git_object*)*rev.commit.tree(), &opts);
+        // Remember the tree that we're replacing, so that we only update the submodules
+        // that it records a different commit for
+        const Tree treePrev = headTree();
+        const Tree tree = rev.commit.tree();
+        int ir = git_checkout_tree(*get(), (git_object*)*tree, &opts);
         if (ir == GIT_ECONFLICT) throw ConflictError(ir, ctx.conflicts);
         else if (ir)             throw Error(ir, "git_checkout_tree failed");
         
@@ -754,7 +925,7 @@ public:
             if (ir) throw Error(ir, "git_repository_set_head_detached failed");
         }
         
-        submodulesUpdate(true);
+        submodulesUpdate(treePrev, tree, true, progress);
     }
     
     
@@ -763,8 +934,8 @@ public:
         if (ir) throw Error(ir, "git_repository_detach_head failed");
     }
     
-    void headAttach(const Rev& rev) const {
-        checkout(rev);
+    void headAttach(const Rev& rev, const SubmodulesProgress& progress=nullptr) const {
+        checkout(rev, progress);
     }
     
 //    void headDetach() const {
@@ -863,11 +1034,7 @@ public:
         Id treeId;
         int ir = git_index_write_tree_to(&treeId, *index, *get());
         if (ir) throw Error(ir, "git_index_write_tree_to failed");
-        
-        git_tree* x = nullptr;
-        ir = git_tree_lookup(&x, *get(), &treeId);
-        if (ir) throw Error(ir, "git_tree_lookup failed");
-        return x;
+        return treeLookup(treeId);
     }
     
     // commitParentSet(): commit.parent[0] = parent
@@ -891,10 +1058,42 @@ public:
         }
     }
     
+    // commitParentSetSplice(): fast path for commitParentSet()
+    // Returns the tree that results from applying `commit`'s changes to `parent`, by splicing
+    // the entries that `commit` changed into `parent`'s tree, without performing a merge.
+    // Returns null if `commit` and `parent` change any of the same paths (relative to
+    // `commit`'s original parent), in which case commitParentSet() is required.
+    Tree commitParentSetSplice(const Commit& commit, const Commit& parent) const {
+        assert(commit);
+        
+        const Commit oldParent = commit.parent();
+        const Tree baseTree = (oldParent ? oldParent.tree() : nullptr);
+        const Tree oursTree = (parent ? parent.tree() : nullptr);
+        const Tree theirsTree = commit.tree();
+        
+        Id id;
+        if (!_treeSplice(id, baseTree, oursTree, theirsTree)) return nullptr;
+        
+        // The result is the empty tree, which _treeSplice() doesn't write
+        if (git_oid_is_zero(&id)) {
+            git_treebuilder* builder = nullptr;
+            int ir = git_treebuilder_new(&builder, *get(), nullptr);
+            if (ir) throw Error(ir, "git_treebuilder_new failed");
+            Defer(git_treebuilder_free(builder));
+            ir = git_treebuilder_write(&id, builder);
+            if (ir) throw Error(ir, "git_treebuilder_write failed");
+        }
+        
+        return treeLookup(id);
+    }
+    
     Commit commitParentSetFinish(const Index& index, const Commit& commit, const Commit& parent) const {
+        return commitParentSetFinish(indexWrite(index), commit, parent);
+    }
+    
+    Commit commitParentSetFinish(const Tree& tree, const Commit& commit, const Commit& parent) const {
         assert(commit);
         
-        Tree tree = indexWrite(index);
         std::vector<Commit> parents = commit.parents();
         if (!parents.empty()) parents.erase(parents.begin());
         if (parent) parents.insert(parents.begin(), parent);
@@ -925,6 +1124,27 @@ public:
         return commitLookup(id);
     }
     
+    // commitSquash(): combines `dst` and `srcs` into a single commit, where `srcs` are the
+    // descendants of `dst`, ordered oldest to newest, with no other commits between them
+    // Equivalent to calling commitIntegrate() for each commit in `srcs`, but since no
+    // merging is necessary, the result is created directly from the newest tree.
+    Commit commitSquash(const Commit& dst, const std::vector<Commit>& srcs) const {
+        assert(!srcs.empty());
+        
+        // Combine the commit messages
+        std::string msg = git_commit_message(*dst);
+        for (const Commit& src : srcs) {
+            msg += "\n";
+            msg += git_commit_message(*src);
+        }
+        
+        const Tree tree = srcs.back().tree();
+        Id id;
+        int ir = git_commit_amend(&id, *dst, nullptr, nullptr, nullptr, git_commit_message_encoding(*dst), msg.c_str(), *tree);
+        if (ir) throw Error(ir, "git_commit_amend failed");
+        return commitLookup(id);
+    }
+    
     // commitAmend(): change parents/tree of a commit
     Commit commitAmend(const Commit& commit, const std::vector<Commit>& parents, const Tree& tree) const {
         Id id;
@@ -960,6 +1180,13 @@ public:
         return commitLookup(id);
     }
     
+    Tree treeLookup(const Id& id) const {
+        git_tree* x = nullptr;
+        int ir = git_tree_lookup(&x, *get(), &id);
+        if (ir) throw Error(ir, "git_tree_lookup failed");
+        return x;
+    }
+    
     Commit commitLookup(const Id& id) const {
         git_commit* x = nullptr;
         int ir = git_commit_lookup(&x, *get(), &id);
@@ -974,17 +1201,49 @@ public:
 //        return commitLookup(id);
 //    }
     
+    Transaction transactionCreate() const {
+        git_transaction* x = nullptr;
+        int ir = git_transaction_new(&x, *get());
+        if (ir) throw Error(ir, "git_transaction_new failed");
+        return x;
+    }
+    
+    void transactionCommit(const Transaction& tx) const {
+        int ir = git_transaction_commit(*tx);
+        if (ir) throw Error(ir, "git_transaction_commit failed");
+    }
+    
     Ref refReplace(const Ref& ref, const Commit& commit) const {
-        if (ref.isLocalBranch()) {
-            return branchReplace(Branch::ForRef(ref), commit);
-        
-        } else if (ref.isTag()) {
-            return tagReplace(Tag::ForRef(ref), commit);
-        
-        } else {
+        const Transaction tx = transactionCreate();
+        refReplace(tx, ref, commit);
+        transactionCommit(tx);
+        return refReload(ref);
+    }
+    
+    // refReplace(): stages pointing `ref` at `commit` in `tx`
+    void refReplace(const Transaction& tx, const Ref& ref, const Commit& commit) const {
+        refReplace(tx, ref, commit, refTargetCreate(ref, commit));
+    }
+    
+    // refReplace(): stages pointing `ref` at `commit` in `tx`, via `target` (which must
+    // come from refTargetCreate())
+    // Creating the target is separate so that callers that stage objects in memory (see
+    // Mempack) can create it before writing out the staged objects, since a ref must
+    // never target an object that only exists in memory.
+    void refReplace(const Transaction& tx, const Ref& ref, const Commit& commit, const Id& target) const {
+        if (!ref.isLocalBranch() && !ref.isTag()) {
             // Unknown ref type
             abort();
         }
+        
+        const std::string msg = (ref.isTag() ? "tag: Moved to " : "branch: Reset to ") + commit.idStr();
+        _transactionRefSet(tx, ref.fullName(), target, msg);
+    }
+    
+    // refTargetCreate(): returns the object that `ref` needs to target in order to point
+    // at `commit`, creating it if necessary (ie a new annotation for annotated tags)
+    Id refTargetCreate(const Ref& ref, const Commit& commit) const {
+        return _refTargetCreate(ref, ref.name(), commit);
     }
     
 //    Rev revReplace(const Rev& rev, const Commit& commit) const {
@@ -997,13 +1256,6 @@ public:
 //        return Rev(refReplace(rev.ref, commit), rev.refSkip);
 //    }
     
-    Tag tagReplace(const Tag& tag, const Commit& commit) const {
-        if (TagAnnotation ann = tag.annotation()) {
-            return tagCreateAnnotated(tag.name(), commit, ann.author(), ann.message(), true);
-        }
-        return tagCreate(tag.name(), commit, true);
-    }
-    
     Ref refLookup(const std::string& name) const {
         git_reference* x = nullptr;
         int ir = git_reference_dwim(&x, *get(), name.c_str());
@@ -1023,23 +1275,72 @@ public:
     }
     
     Ref refCopy(const Ref& ref, const std::string& name, Commit commit=nullptr) const {
+        const Transaction tx = transactionCreate();
+        const std::string fullName = refCopy(tx, ref, name, commit);
+        transactionCommit(tx);
+        return refFullNameLookup(fullName);
+    }
+    
+    // refCopy(): stages creating a ref named `name`, of the same type as `ref`, that
+    // points at `commit` (or `ref`'s commit if `commit` is null)
+    // Returns the full name of the new ref
+    std::string refCopy(const Transaction& tx, const Ref& ref, const std::string& name, Commit commit=nullptr) const {
         if (!commit) commit = ref.commit();
         
+        std::string fullName;
+        int valid = 0;
+        int ir = 0;
         if (ref.isBranch()) {
-            return branchCreate(name, commit, false);
+            fullName = "refs/heads/" + name;
+            ir = git_branch_name_is_valid(&valid, name.c_str());
         
         } else if (ref.isTag()) {
-            const Tag tag = Tag::ForRef(ref);
-            if (const TagAnnotation ann = tag.annotation()) {
-                return tagCreateAnnotated(name, commit, ann.author(), ann.message());
-            } else {
-                return tagCreate(name, commit);
-            }
+            fullName = "refs/tags/" + name;
+            ir = git_tag_name_is_valid(&valid, name.c_str());
         
         } else {
             // Unsupported ref type
             throw Toastbox::RuntimeError("unsupported ref type");
         }
+        
+        if (ir) throw Error(ir, "failed to validate ref name");
+        if (!valid) {
+            git_error_set_str(GIT_ERROR_REFERENCE, ("invalid ref name: " + name).c_str());
+            throw Error(GIT_EINVALIDSPEC);
+        }
+        
+        // Transactions overwrite existing refs, so explicitly check that the ref doesn't
+        // exist, to match git_branch_create()/git_tag_create() with force=false
+        {
+            git_reference* x = nullptr;
+            ir = git_reference_lookup(&x, *get(), fullName.c_str());
+            git_reference_free(x);
+            if (!ir) {
+                git_error_set_str(GIT_ERROR_REFERENCE, ("ref already exists: " + name).c_str());
+                throw Error(GIT_EEXISTS);
+            }
+            if (ir != GIT_ENOTFOUND) throw Error(ir, "git_reference_lookup failed");
+        }
+        
+        const std::string msg = (ref.isTag() ? "tag: Created from " : "branch: Created from ") + commit.idStr();
+        _transactionRefSet(tx, fullName, _refTargetCreate(ref, name, commit), msg);
+        return fullName;
+    }
+    
+    // refDelete(): stages deleting `ref` in `tx`
+    // Unlike git_reference_delete(), transactions leave the ref's reflog in place, so
+    // callers should follow a successful transactionCommit() with reflogDelete()
+    void refDelete(const Transaction& tx, const Ref& ref) const {
+        if (!ref.isLocalBranch() && !ref.isTag()) {
+            // Unsupported ref type
+            throw Toastbox::RuntimeError("unsupported ref type");
+        }
+        
+        const std::string fullName = ref.fullName();
+        int ir = git_transaction_lock_ref(*tx, fullName.c_str());
+        if (ir) throw Error(ir, "git_transaction_lock_ref failed");
+        ir = git_transaction_remove(*tx, fullName.c_str());
+        if (ir) throw Error(ir, "git_transaction_remove failed");
     }
     
     void refDelete(const Ref& ref) {
@@ -1093,18 +1394,6 @@ public:
         return x;
     }
     
-    Branch branchReplace(const Branch& branch, const Commit& commit) const {
-        Branch upstream = branch.upstream();
-        Branch newBranch = branchCreate(branch.name(), commit, true);
-        Branch newBranchUpstream = newBranch.upstream();
-        
-        if (upstream && !newBranchUpstream) {
-            newBranch.upstreamSet(upstream);
-        }
-        
-        return newBranch;
-    }
-    
     // branchNameLocal(): returns the local branch name for a branch:
     //   master         -> master
     //   origin/master  -> master
@@ -1163,26 +1452,63 @@ public:
         return x;
     }
     
-    bool dirty() const {
-        StatusList s = status();
-        for (size_t i=0;; i++) {
-            const git_status_entry* e = s[i];
-            if (!e) break;
-            
-            constexpr int Dirty =
-                GIT_STATUS_INDEX_MODIFIED   |
-                GIT_STATUS_INDEX_DELETED    |
-                GIT_STATUS_INDEX_RENAMED    |
-                GIT_STATUS_INDEX_TYPECHANGE |
-                GIT_STATUS_WT_MODIFIED      |
-                GIT_STATUS_WT_DELETED       |
-                GIT_STATUS_WT_RENAMED       |
-                GIT_STATUS_WT_TYPECHANGE    ;
-            
-            if (Dirty & e->status) {
-                return true;
+    // dirty(): returns whether tracked files have changes, either staged or in the working
+    // tree. Untracked files aren't considered, and the working tree is compared using the
+    // index's stat cache, so only files whose stat info changed are read. Returns as soon
+    // as the first change is found.
+    // `cancel`: optional; once set, the check is aborted by throwing
+    bool dirty(const std::atomic<bool>* cancel=nullptr) const {
+        struct Ctx {
+            const std::atomic<bool>* cancel = nullptr;
+            bool dirty = false;
+        };
+        
+        Ctx ctx = { .cancel = cancel };
+        git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+        opts.flags = GIT_DIFF_SKIP_BINARY_CHECK;
+        opts.payload = &ctx;
+        opts.notify_cb = [] (const git_diff*, const git_diff_delta* delta, const char*, void* payload) {
+            Ctx& ctx = *(Ctx*)payload;
+            switch (delta->status) {
+            case GIT_DELTA_MODIFIED:
+            case GIT_DELTA_DELETED:
+            case GIT_DELTA_RENAMED:
+            case GIT_DELTA_TYPECHANGE:
+                // Abort the diff; we have our answer
+                ctx.dirty = true;
+                return -1;
+            default:
+                // Skip the delta
+                return 1;
             }
+        };
+        opts.progress_cb = [] (const git_diff*, const char*, const char*, void* payload) {
+            Ctx& ctx = *(Ctx*)payload;
+            return (ctx.cancel && *ctx.cancel ? -1 : 0);
+        };
+        
+        // HEAD doesn't have a tree if the current branch is unborn, in which case we
+        // compare the index against the empty tree
+        const Tree tree = headTree();
+        
+        // HEAD -> index
+        {
+            git_diff* diff = nullptr;
+            int ir = git_diff_tree_to_index(&diff, *get(), (tree ? *tree : nullptr), nullptr, &opts);
+            git_diff_free(diff);
+            if (ctx.dirty) return true;
+            if (ir) throw Error(ir, "git_diff_tree_to_index failed");
         }
+        
+        // Index -> working tree
+        {
+            git_diff* diff = nullptr;
+            int ir = git_diff_index_to_workdir(&diff, *get(), nullptr, &opts);
+            git_diff_free(diff);
+            if (ctx.dirty) return true;
+            if (ir) throw Error(ir, "git_diff_index_to_workdir failed");
+        }
+        
         return false;
     }
     
@@ -1226,15 +1552,109 @@ public:
         return ctx.submodules;
     }
     
-    void submodulesUpdate(bool recurse=false) const {
-        std::vector<Submodule> sms = submodules();
-        for (Submodule sm : sms) {
+    Submodule submoduleLookup(const std::filesystem::path& path) const {
+        git_submodule* x = nullptr;
+        int ir = git_submodule_lookup(&x, *get(), path.c_str());
+        if (ir) throw Error(ir, "git_submodule_lookup failed");
+        return x;
+    }
+    
+    // submodulesUpdate(): updates the submodules whose recorded commit differs between
+    // `treePrev` and `tree` (or every submodule if `treePrev` is null), and their nested
+    // submodules if `recurse`=true.
+    // The submodules are updated by a pool of threads, and every submodule is updated
+    // using its own handles to the repositories involved. `progress` is called by one
+    // thread at a time.
+    void submodulesUpdate(const Tree& treePrev, const Tree& tree, bool recurse=false,
+        const SubmodulesProgress& progress=nullptr) const {
+        
+        struct Task {
+            std::filesystem::path repoDir; // Git directory of the containing repository
+            std::filesystem::path path; // Submodule path within the containing repository
+            std::optional<Id> idPrev; // Commit that the submodule was at before the update, if known
+        };
+        
+        std::mutex lock;
+        std::condition_variable signal;
+        std::deque<Task> tasks;
+        size_t active = 0;
+        size_t done = 0;
+        size_t total = 0;
+        std::exception_ptr err;
+        
+        const auto tasksPush = [&] (const Repo& repo, const Tree& treePrev, const Tree& tree) {
+            const std::filesystem::path repoDir = git_repository_path(*repo);
+            for (const auto& [path, idPrev] : repo._submodulesChanged(treePrev, tree)) {
+                tasks.push_back({ .repoDir = repoDir, .path = path, .idPrev = idPrev });
+                total++;
+            }
+        };
+        
+        tasksPush(*this, treePrev, tree);
+        if (tasks.empty()) return;
+        if (progress) progress(done, total);
+        
+        const auto taskRun = [&] (const Task& task) {
+            const Repo repo = _OpenDir(task.repoDir);
+            Submodule sm = repo.submoduleLookup(task.path);
             sm.update();
-            if (recurse) {
-                Repo repo = Repo::Open(sm);
-                repo.submodulesUpdate(recurse);
+            if (!recurse) return;
+            
+            // Update the nested submodules that changed between the submodule's
+            // previous commit and its new one
+            const Repo smRepo = Repo::Open(sm);
+            Tree smTreePrev;
+            if (task.idPrev) {
+                try {
+                    smTreePrev = smRepo.commitLookup(*task.idPrev).tree();
+                } catch (...) {}
             }
-        }
+            const Tree smTree = smRepo.commitLookup(*sm.indexId()).tree();
+            
+            auto l = std::unique_lock(lock);
+            tasksPush(smRepo, smTreePrev, smTree);
+        };
+        
+        const auto worker = [&] {
+            auto l = std::unique_lock(lock);
+            for (;;) {
+                // Wait for a task, or for all tasks to be complete (since running
+                // tasks can add more tasks)
+                signal.wait(l, [&] { return !tasks.empty() || !active || err; });
+                if (tasks.empty() || err) break;
+                
+                const Task task = tasks.front();
+                tasks.pop_front();
+                active++;
+                l.unlock();
+                
+                std::exception_ptr e;
+                try {
+                    taskRun(task);
+                } catch (...) {
+                    e = std::current_exception();
+                }
+                
+                l.lock();
+                active--;
+                done++;
+                if (e && !err) err = e;
+                if (!err && progress) progress(done, total);
+                signal.notify_all();
+            }
+        };
+        
+        // The pool isn't sized by the initial number of tasks, since updating a submodule
+        // can queue its nested submodules. Idle workers just wait for those tasks, and
+        // exit once every task is complete.
+        const size_t threadCount = std::max((size_t)1,
+            std::min((size_t)std::thread::hardware_concurrency(), _SubmodulesUpdateThreadCountMax));
+        std::vector<std::thread> threads;
+        for (size_t i=1; i<threadCount; i++) threads.emplace_back(worker);
+        worker();
+        for (std::thread& t : threads) t.join();
+        
+        if (err) std::rethrow_exception(err);
     }
     
     Reflog reflogForRef(const Ref& ref) const {
@@ -1244,6 +1664,17 @@ public:
         return x;
     }
     
+    // reflogTailForRef(): returns a ReflogTail for `ref`, for reading its most recent
+    // entries without parsing the whole reflog
+    ReflogTail reflogTailForRef(const Ref& ref) const {
+        const std::string name = ref.fullName();
+        // HEAD's reflog belongs to the worktree, while other refs' reflogs are shared
+        // by all worktrees
+        const std::filesystem::path dir = (name=="HEAD" ?
+            git_repository_path(*get()) : git_repository_commondir(*get()));
+        return ReflogTail(dir / "logs" / name);
+    }
+    
     static constexpr const char MergeMarkerBareStart[]      = "<<<<<<<";
     static constexpr const char MergeMarkerBareSeparator[]  = "=======";
     static constexpr const char MergeMarkerBareEnd[]        = ">>>>>>>";
@@ -1332,9 +1763,16 @@ public:
         
         const char* msg = git_reflog_entry_message(entry);
         if (!msg) throw std::runtime_error("invalid message");
-        if (!Toastbox::String::StartsWith("checkout: moving from ", msg)) throw std::runtime_error("not a checkout entry");
+        return reflogRevForCheckoutEntry(msg);
+    }
+    
+    Rev reflogRevForCheckoutEntry(const ReflogTail::Entry& entry) const {
+        return reflogRevForCheckoutEntry(entry.message);
+    }
+    
+    Rev reflogRevForCheckoutEntry(std::string_view msgv) const {
+        if (!Toastbox::String::StartsWith("checkout: moving from ", msgv)) throw std::runtime_error("not a checkout entry");
         
-        const std::string_view msgv = msg;
         const size_t lastSpaceIdx = msgv.find_last_of(' ');
         // This function should only be called for checkout reflog messages, so there must be a space.
         // If there's not, it's programmer error.
@@ -1349,18 +1787,292 @@ public:
         return revLookup(std::string(revName));
     }
     
+    void reflogDelete(const Ref& ref) const {
+        int ir = git_reflog_delete(*get(), ref.fullName().c_str());
+        if (ir) throw Error(ir, "git_reflog_delete failed");
+    }
+    
+    // reflogRememberRef(): adds checkout entries to HEAD's reflog for moving to `ref` and
+    // back, so that `ref` is one of the recently checked-out revs that debase shows
+    // The entries are appended to the log file, instead of rewriting it via Reflog::append(),
+    // so the cost doesn't depend on the size of the reflog.
     void reflogRememberRef(const Ref& ref) {
-        const Reflog reflog = reflogForRef(head());
         const Rev headRev = headResolved();
         const Git::Signature sig = signatureCreateDefault();
-        reflog.append(sig, headRev, ref);
-        reflog.append(sig, ref, headRev);
+        reflogAppend(head(), sig, {
+            { ref.commit().id(), Reflog::CheckoutMessage(headRev, ref) },
+            { headRev.commit.id(), Reflog::CheckoutMessage(ref, headRev) },
+        });
+    }
+    
+    // reflogAppend(): appends entries to `ref`'s reflog, where each entry is the id that
+    // `ref` moved to, and a message
+    // The entries are written while holding `ref`'s lock, the same way that git writes
+    // to a reflog when updating a ref.
+    void reflogAppend(const Ref& ref, const Signature& sig,
+        const std::vector<std::pair<Id,std::string>>& entries) const {
+        
+        const std::string name = ref.fullName();
+        const std::filesystem::path dir = (name=="HEAD" ?
+            git_repository_path(*get()) : git_repository_commondir(*get()));
+        const std::filesystem::path lockPath = dir / (name + ".lock");
+        const std::filesystem::path logPath = dir / "logs" / name;
+        
+        // Take the lock before reading the reflog's last entry, so that another writer
+        // can't append to the reflog in between
+        const int lock = open(lockPath.c_str(), O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0644);
+        if (lock < 0) throw RuntimeError("failed to lock %s: %s", name.c_str(), strerror(errno));
+        Defer(
+            close(lock);
+            unlink(lockPath.c_str());
+        );
+        
+        // Each entry records the id that the ref moved from, which is the id that the
+        // previous entry moved to
+        Id idPrev = {};
+        {
+            ReflogTail reflog(logPath);
+            if (const std::optional<ReflogTail::Entry> e = reflog.next()) idPrev = e->idNew;
+        }
+        
+        std::string lines;
+        for (const auto& [id, msg] : entries) {
+            lines += _ReflogLine(idPrev, id, sig, msg);
+            idPrev = id;
+        }
+        
+        std::filesystem::create_directories(logPath.parent_path());
+        const int fd = open(logPath.c_str(), O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+        if (fd < 0) throw RuntimeError("failed to open reflog: %s", strerror(errno));
+        Defer(close(fd));
+        
+        // Write all the entries at once, so that they're appended contiguously
+        const ssize_t sr = write(fd, lines.data(), lines.size());
+        if (sr != (ssize_t)lines.size()) throw RuntimeError("failed to write reflog: %s", strerror(errno));
     }
     
 private:
+    static constexpr size_t _SubmodulesUpdateThreadCountMax = 8;
+    
+    // _OpenDir(): opens the repository whose git directory is `dir`
+    // Unlike Open(), `dir` can be a git directory that's not located within its working
+    // directory, such as a submodule's.
+    static Repo _OpenDir(const std::filesystem::path& dir) {
+        bool shutdown = true;
+        git_libgit2_init();
+        Defer( if (shutdown) git_libgit2_shutdown() );
+        
+        git_repository* x = nullptr;
+        int ir = git_repository_open(&x, dir.c_str());
+        if (ir) throw Error(ir, "git_repository_open failed");
+        
+        // We succeeded -- don't call shutdown!
+        shutdown = false;
+        return x;
+    }
+    
+    // _ReflogLine(): returns a reflog line, which has the form:
+    //   <old id> <new id> <name> <<email>> <time> <tz>\t<message>\n
+    static std::string _ReflogLine(const Id& idOld, const Id& idNew, const Signature& sig, std::string_view msg) {
+        const git_signature& s = **sig;
+        const int offset = std::abs(s.when.offset);
+        char tz[16];
+        snprintf(tz, sizeof(tz), "%c%02d%02d", (s.when.offset<0 ? '-' : '+'), offset/60, offset%60);
+        
+        std::string line = StringFromId(idOld) + " " + StringFromId(idNew) + " ";
+        line += std::string(s.name) + " <" + s.email + "> " + std::to_string(s.when.time) + " " + tz;
+        line += "\t";
+        // Messages are a single line
+        for (char c : msg) line += (c=='\n' ? ' ' : c);
+        line += "\n";
+        return line;
+    }
+    
     static bool _HEADSpecialPointer(std::string_view name) {
         return Toastbox::String::EndsWith("HEAD", name);
     }
+    
+    // _submodulesChanged(): returns the path of each submodule whose commit differs between
+    // `treePrev` and `tree`, along with its commit in `treePrev` (if any)
+    // Every submodule is returned if `treePrev` is null.
+    std::vector<std::pair<std::filesystem::path,std::optional<Id>>> _submodulesChanged(
+        const Tree& treePrev, const Tree& tree) const {
+        
+        // Returns the id recorded for `path` in `tree`, if any
+        const auto entryId = [] (const Tree& tree, const std::filesystem::path& path) -> std::optional<Id> {
+            git_tree_entry* e = nullptr;
+            if (git_tree_entry_bypath(&e, *tree, path.c_str())) return std::nullopt;
+            Defer(git_tree_entry_free(e));
+            return *git_tree_entry_id(e);
+        };
+        
+        std::vector<std::pair<std::filesystem::path,std::optional<Id>>> r;
+        for (const Submodule& sm : submodules()) {
+            const std::filesystem::path path = sm.path();
+            if (!treePrev) {
+                r.push_back({path, std::nullopt});
+                continue;
+            }
+            
+            const std::optional<Id> idPrev = entryId(treePrev, path);
+            const std::optional<Id> id = entryId(tree, path);
+            if (idPrev && id && git_oid_equal(&*idPrev, &*id)) continue;
+            r.push_back({path, idPrev});
+        }
+        return r;
+    }
+    
+    static bool _TreeEntryEqual(const git_tree_entry* a, const git_tree_entry* b) {
+        if (!a || !b) return a==b;
+        return git_tree_entry_filemode(a)==git_tree_entry_filemode(b) &&
+            git_oid_equal(git_tree_entry_id(a), git_tree_entry_id(b));
+    }
+    
+    static bool _TreeEntryIsTree(const git_tree_entry* e) {
+        return e && git_tree_entry_type(e)==GIT_OBJECT_TREE;
+    }
+    
+    // _treeSplice(): performs a 3-way merge of trees `base`, `ours` and `theirs`, as long
+    // as `ours` and `theirs` don't modify any of the same paths relative to `base`
+    // Any of the trees can be null, which is equivalent to an empty tree.
+    // Only the subtrees that both sides modified are visited, so the cost is proportional
+    // to the number of paths that changed, rather than the size of the trees.
+    // Returns false if the trees overlap and therefore need a real merge, in which
+    // case `out` is undefined. If the resulting tree is empty, `out` is zeroed.
+    bool _treeSplice(Id& out, const Tree& base, const Tree& ours, const Tree& theirs) const {
+        const Id* baseId = (base ? git_tree_id(*base) : nullptr);
+        const Id* oursId = (ours ? git_tree_id(*ours) : nullptr);
+        const Id* theirsId = (theirs ? git_tree_id(*theirs) : nullptr);
+        const auto idEqual = [] (const Id* a, const Id* b) {
+            if (!a || !b) return a==b;
+            return (bool)git_oid_equal(a, b);
+        };
+        
+        // Trivial cases: only one side changed anything, or both sides made the same changes
+        if (idEqual(theirsId, baseId) || idEqual(theirsId, oursId) || idEqual(oursId, baseId)) {
+            const Id* id = (idEqual(theirsId, baseId) ? oursId : theirsId);
+            if (id) out = *id;
+            else    out = {};
+            return true;
+        }
+        
+        // Collect the names of the entries that `theirs` changed relative to `base`
+        std::vector<std::string> changed;
+        const size_t theirsCount = (theirs ? git_tree_entrycount(*theirs) : 0);
+        for (size_t i=0; i<theirsCount; i++) {
+            const git_tree_entry* e = git_tree_entry_byindex(*theirs, i);
+            const char* name = git_tree_entry_name(e);
+            const git_tree_entry* be = (base ? git_tree_entry_byname(*base, name) : nullptr);
+            if (!_TreeEntryEqual(e, be)) changed.push_back(name);
+        }
+        
+        const size_t baseCount = (base ? git_tree_entrycount(*base) : 0);
+        for (size_t i=0; i<baseCount; i++) {
+            const git_tree_entry* e = git_tree_entry_byindex(*base, i);
+            const char* name = git_tree_entry_name(e);
+            if (!theirs || !git_tree_entry_byname(*theirs, name)) changed.push_back(name);
+        }
+        
+        // Apply `theirs` changes on top of `ours`
+        git_treebuilder* builder = nullptr;
+        int ir = git_treebuilder_new(&builder, *get(), (ours ? *ours : nullptr));
+        if (ir) throw Error(ir, "git_treebuilder_new failed");
+        Defer(git_treebuilder_free(builder));
+        
+        for (const std::string& name : changed) {
+            const git_tree_entry* be = (base ? git_tree_entry_byname(*base, name.c_str()) : nullptr);
+            const git_tree_entry* oe = (ours ? git_tree_entry_byname(*ours, name.c_str()) : nullptr);
+            const git_tree_entry* te = (theirs ? git_tree_entry_byname(*theirs, name.c_str()) : nullptr);
+            
+            // Both sides made the same change
+            if (_TreeEntryEqual(oe, te)) continue;
+            
+            Id id;
+            git_filemode_t mode = GIT_FILEMODE_UNREADABLE;
+            if (_TreeEntryEqual(oe, be)) {
+                // Only `theirs` changed the entry
+                if (te) {
+                    id = *git_tree_entry_id(te);
+                    mode = git_tree_entry_filemode(te);
+                }
+            
+            } else if (_TreeEntryIsTree(oe) && _TreeEntryIsTree(te) && (!be || _TreeEntryIsTree(be))) {
+                // Both sides changed the same directory; descend into it
+                const Tree bt = (be ? treeLookup(*git_tree_entry_id(be)) : nullptr);
+                const Tree ot = treeLookup(*git_tree_entry_id(oe));
+                const Tree tt = treeLookup(*git_tree_entry_id(te));
+                if (!_treeSplice(id, bt, ot, tt)) return false;
+                if (!git_oid_is_zero(&id)) mode = GIT_FILEMODE_TREE;
+            
+            } else {
+                // Both sides changed the same file
+                return false;
+            }
+            
+            if (mode != GIT_FILEMODE_UNREADABLE) {
+                ir = git_treebuilder_insert(nullptr, builder, name.c_str(), &id, mode);
+                if (ir) throw Error(ir, "git_treebuilder_insert failed");
+            } else if (oe) {
+                ir = git_treebuilder_remove(builder, name.c_str());
+                if (ir) throw Error(ir, "git_treebuilder_remove failed");
+            }
+        }
+        
+        // Git doesn't store empty directories
+        if (!git_treebuilder_entrycount(builder)) {
+            out = {};
+            return true;
+        }
+        
+        ir = git_treebuilder_write(&out, builder);
+        if (ir) throw Error(ir, "git_treebuilder_write failed");
+        return true;
+    }
+    
+    // _refTargetCreate(): returns the object that a ref named `name`, of the same type as
+    // `ref`, needs to target in order to point at `commit`
+    Id _refTargetCreate(const Ref& ref, const std::string& name, const Commit& commit) const {
+        if (ref.isTag()) {
+            // Annotated tags need a new annotation object that targets `commit`
+            if (const TagAnnotation ann = Tag::ForRef(ref).annotation()) {
+                Id id;
+                int ir = git_tag_annotation_create(&id, *get(), name.c_str(), *(Object)commit,
+                    *ann.author(), ann.message().c_str());
+                if (ir) throw Error(ir, "git_tag_annotation_create failed");
+                return id;
+            }
+        }
+        return commit.id();
+    }
+    
+    void _transactionRefSet(const Transaction& tx, const std::string& fullName, const Id& target, const std::string& msg) const {
+        int ir = git_transaction_lock_ref(*tx, fullName.c_str());
+        if (ir) throw Error(ir, "git_transaction_lock_ref failed");
+        ir = git_transaction_set_target(*tx, fullName.c_str(), &target, nullptr, msg.c_str());
+        if (ir) throw Error(ir, "git_transaction_set_target failed");
+    }
+};
+
+// RepoShared: base class for per-repository state that's shared by all Repo handles that
+// refer to the same repository (ie the same common git directory, so worktrees share too)
+// T is created via T(git_repository*) the first time ForRepo() is called for a repository,
+// and lives for the rest of the process. T must befriend RepoShared<T> if its constructor
+// is private.
+template <typename T>
+class RepoShared {
+public:
+    static T& ForRepo(git_repository* repo) {
+        static std::mutex Lock;
+        static std::map<std::string,std::unique_ptr<T>> Instances;
+        
+        const std::string dir = git_repository_commondir(repo);
+        auto lock = std::unique_lock(Lock);
+        std::unique_ptr<T>& x = Instances[dir];
+        if (!x) x = std::unique_ptr<T>(new T(repo));
+        return *x;
+    }
+    
+    static T& ForRepo(const Repo& repo) { return ForRepo(*repo); }
 };
 
 #undef _Equal
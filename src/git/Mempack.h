@@ -0,0 +1,160 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include "Git.h"
+#include "lib/libgit2/include/git2/sys/odb_backend.h"
+#include "lib/libgit2/include/git2/sys/mempack.h"
+#include "lib/libgit2/include/git2/sys/repository.h"
+
+namespace Git {
+
+// Mempack: redirects every object written to `repo` into an in-memory object
+// database (a libgit2 mempack backend), until flush() writes them all out as a
+// single packfile.
+//
+// Objects that haven't been flushed when the Mempack is destroyed are dropped
+// without touching the disk, and the repository's original object database is
+// restored.
+//
+// Like any git_odb, the object database can be shared with other handles to the
+// repository (see Repo::reopen()) and used from multiple threads.
+class Mempack {
+public:
+    Mempack(const Repo& repo) : _repo(repo) {
+        {
+            git_odb* x = nullptr;
+            int ir = git_repository_odb(&x, *_repo);
+            if (ir) throw Error(ir, "git_repository_odb failed");
+            _odbOrig = x;
+        }
+        
+        // Create a new object database on top of the repository's objects directory
+        // and install it in place of the original one, so that our backend can be
+        // removed simply by restoring the original
+        {
+            const std::string dir = std::string(git_repository_commondir(*_repo)) + "objects";
+            git_odb* x = nullptr;
+            int ir = git_odb_open(&x, dir.c_str());
+            if (ir) throw Error(ir, "git_odb_open failed");
+            _odb = x;
+        }
+        
+        {
+            _Backend* x = new _Backend();
+            int ir = git_odb_init_backend(&x->backend, GIT_ODB_BACKEND_VERSION);
+            if (!ir) ir = git_mempack_new(&x->mempack);
+            if (ir) {
+                _BackendFree(&x->backend);
+                throw Error(ir, "failed to create mempack backend");
+            }
+            
+            x->backend.read = _BackendRead;
+            x->backend.read_header = _BackendReadHeader;
+            x->backend.write = _BackendWrite;
+            x->backend.exists = _BackendExists;
+            x->backend.free = _BackendFree;
+            
+            // Our backend must have the highest priority so that it receives all writes
+            ir = git_odb_add_backend(*_odb, &x->backend, _Priority);
+            if (ir) {
+                _BackendFree(&x->backend);
+                throw Error(ir, "git_odb_add_backend failed");
+            }
+            // `_odb` owns the backend now
+            _backend = x;
+        }
+        
+        int ir = git_repository_set_odb(*_repo, *_odb);
+        if (ir) throw Error(ir, "git_repository_set_odb failed");
+    }
+    
+    ~Mempack() {
+        // Drop any objects that weren't flushed, and restore the original object database
+        _reset();
+        git_repository_set_odb(*_repo, *_odbOrig);
+    }
+    
+    Mempack(const Mempack&) = delete;
+    Mempack& operator=(const Mempack&) = delete;
+    
+    // flush(): writes the objects created so far to a single packfile
+    void flush() {
+        if (_backend->written.empty()) return;
+        
+        git_packbuilder* pb = nullptr;
+        int ir = git_packbuilder_new(&pb, *_repo);
+        if (ir) throw Error(ir, "git_packbuilder_new failed");
+        Defer(git_packbuilder_free(pb));
+        
+        // Only pack the objects that we created, rather than using git_mempack_dump(),
+        // which packs the entire tree of every commit
+        for (const Id& id : _backend->written) {
+            ir = git_packbuilder_insert(pb, &id, nullptr);
+            if (ir) throw Error(ir, "git_packbuilder_insert failed");
+        }
+        
+        ir = git_packbuilder_write(pb, nullptr, 0, nullptr, nullptr);
+        if (ir) throw Error(ir, "git_packbuilder_write failed");
+        
+        _reset();
+    }
+    
+private:
+    static constexpr int _Priority = 999;
+    
+    // _Backend: forwards to a mempack backend, but also records the ids of the
+    // objects written, since mempack doesn't provide a way to enumerate them
+    // Unlike libgit2's own backends, mempack isn't thread-safe, so access is serialized
+    // with `lock`.
+    struct _Backend {
+        git_odb_backend backend = {}; // Must be first
+        git_odb_backend* mempack = nullptr;
+        std::vector<Id> written;
+        std::mutex lock;
+    };
+    
+    static int _BackendRead(void** data, size_t* len, git_object_t* type, git_odb_backend* b, const git_oid* id) {
+        _Backend& backend = *(_Backend*)b;
+        auto lock = std::unique_lock(backend.lock);
+        return backend.mempack->read(data, len, type, backend.mempack, id);
+    }
+    
+    static int _BackendReadHeader(size_t* len, git_object_t* type, git_odb_backend* b, const git_oid* id) {
+        _Backend& backend = *(_Backend*)b;
+        auto lock = std::unique_lock(backend.lock);
+        return backend.mempack->read_header(len, type, backend.mempack, id);
+    }
+    
+    static int _BackendWrite(git_odb_backend* b, const git_oid* id, const void* data, size_t len, git_object_t type) {
+        _Backend& backend = *(_Backend*)b;
+        auto lock = std::unique_lock(backend.lock);
+        int ir = backend.mempack->write(backend.mempack, id, data, len, type);
+        if (!ir) backend.written.push_back(*id);
+        return ir;
+    }
+    
+    static int _BackendExists(git_odb_backend* b, const git_oid* id) {
+        _Backend& backend = *(_Backend*)b;
+        auto lock = std::unique_lock(backend.lock);
+        return backend.mempack->exists(backend.mempack, id);
+    }
+    
+    static void _BackendFree(git_odb_backend* b) {
+        _Backend* backend = (_Backend*)b;
+        if (backend->mempack) backend->mempack->free(backend->mempack);
+        delete backend;
+    }
+    
+    void _reset() {
+        git_mempack_reset(_backend->mempack);
+        _backend->written.clear();
+    }
+    
+    Repo _repo;
+    Odb _odbOrig;
+    Odb _odb;
+    _Backend* _backend = nullptr;
+};
+
+} // namespace Git
@@ -1,9 +1,15 @@
 #pragma once
 #include <fstream>
 #include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
 #include "Git.h"
 #include "Conflict.h"
 #include "Editor.h"
+#include "Ancestry.h"
+#include "Mempack.h"
+#include "RewriteCache.h"
 #include "lib/toastbox/Defer.h"
 #include "lib/toastbox/String.h"
 
@@ -14,9 +20,16 @@ class Modify {
 public:
     struct Ctx {
         Repo repo;
-        std::function<Ref(const Ref&, const Commit&)> refReplace;
+        // refReplace(): stages pointing a ref at a commit in a transaction, via a target
+        // object that's already been created with Repo::refTargetCreate()
+        std::function<void(const Transaction&, const Ref&, const Commit&, const Id&)> refReplace;
         std::function<void(const char*const*)> spawn;
         std::function<void(const Index&, const std::vector<Conflict>&)> conflictsResolve;
+        // progress(): optional; called before each commit is rewritten. Throw Canceled to
+        // cancel the operation, in which case the repository is left untouched.
+        std::function<void()> progress;
+        // rewriteCache: optional; remembers the results of previous rewrites
+        RewriteCache* rewriteCache = nullptr;
     };
     
     struct Op {
@@ -53,16 +66,43 @@ public:
         Res dst;
     };
     
-    class ConflictResolveCanceled : public std::exception {};
+    class Canceled : public std::exception {};
+    class ConflictResolveCanceled : public Canceled {};
     
 private:
+    using _Pos = Ancestry::Pos;
+    
+    // _RevReplace(): returns a copy of `rev` whose commit is `commit`
+    // Exec() applies the change to `rev.ref` once the operation completes
+    static T_Rev _RevReplace(const T_Rev& rev, const Commit& commit) {
+        T_Rev r = rev;
+        r.commit = commit;
+        return r;
+    }
+    
+    // _RevReplaceNeeded(): returns whether `next` represents a change to `prev`'s ref
+    static bool _RevReplaceNeeded(const T_Rev& prev, const T_Rev& next) {
+        return next.ref && next.commit!=prev.commit;
+    }
+    
+    // _Positions: maps the ancestry position of each commit to the commit itself
+    static std::map<_Pos,Commit> _Positions(Ancestry& ancestry, const std::set<Commit>& commits) {
+        std::map<_Pos,Commit> r;
+        for (const Commit& c : commits) r[ancestry.pos(c)] = c;
+        return r;
+    }
+    
     // _Sorted: sorts a set of commits according to the order that they appear via `c`
     static std::vector<Commit> _Sorted(Commit head, const std::set<Commit>& commits) {
+        if (commits.empty()) return {};
+        Ancestry& ancestry = Ancestry::ForCommit(head);
         std::vector<Commit> sorted;
-        std::set<Commit> rem = commits;
-        while (!rem.empty()) {
-            if (rem.erase(head)) sorted.push_back(head);
-            head = head.parent();
+        std::map<_Pos,Commit> rem = _Positions(ancestry, commits);
+        for (_Pos p=ancestry.pos(head); !rem.empty(); p=ancestry.parent(p)) {
+            auto it = rem.find(p);
+            if (it == rem.end()) continue;
+            sorted.push_back(it->second);
+            rem.erase(it);
         }
         
         std::reverse(sorted.begin(), sorted.end());
@@ -71,12 +111,12 @@ private:
     
     static Commit _FindEarliestCommit(Commit head, const std::set<Commit>& commits) {
         assert(!commits.empty());
-        std::set<Commit> rem = commits;
-        while (rem.size() > 1) {
-            rem.erase(head);
-            head = head.parent();
+        Ancestry& ancestry = Ancestry::ForCommit(head);
+        std::map<_Pos,Commit> rem = _Positions(ancestry, commits);
+        for (_Pos p=ancestry.pos(head); rem.size()>1; p=ancestry.parent(p)) {
+            rem.erase(p);
         }
-        return *rem.begin();
+        return rem.begin()->second;
     }
     
     static void _ConflictsHandle(const Ctx& ctx, git_merge_file_favor_t fileFavor, const Index& index) {
@@ -104,13 +144,56 @@ private:
         }
     }
     
+    // _CommitTreesEqual(): returns whether `a` and `b` have the same tree, where a
+    // null commit is treated as having the empty tree
+    static bool _CommitTreesEqual(const Commit& a, const Commit& b) {
+        if (!a || !b) return !a && !b;
+        return git_oid_equal(git_commit_tree_id(*a), git_commit_tree_id(*b));
+    }
+    
+    static void _Progress(const Ctx& ctx) {
+        if (ctx.progress) ctx.progress();
+    }
+    
     static Commit _CommitParentSet(const Ctx& ctx, git_merge_file_favor_t fileFavor, const Commit& commit, const Commit& parent) {
-        Index index = ctx.repo.commitParentSet(fileFavor, commit, parent);
-        _ConflictsHandle(ctx, fileFavor, index);
-        return ctx.repo.commitParentSetFinish(index, commit, parent);
+        _Progress(ctx);
+        
+        // Fastest path: `parent` has the same tree as `commit`'s current parent (eg
+        // because an ancestor's message or author was edited), so `commit`'s tree
+        // doesn't change and we only need to create a commit with the new parent
+        if (_CommitTreesEqual(commit.parent(), parent)) {
+            return ctx.repo.commitParentSetFinish(commit.tree(), commit, parent);
+        }
+        
+        // Fast path: we've performed this exact rewrite before
+        if (ctx.rewriteCache) {
+            if (const Commit r = ctx.rewriteCache->get(ctx.repo, fileFavor, commit, parent)) {
+                return r;
+            }
+        }
+        
+        Commit r;
+        // Fast path: if `commit` and `parent` don't touch any of the same paths, splice
+        // `commit`'s changes into `parent`'s tree, instead of performing a full merge
+        if (const Tree tree = ctx.repo.commitParentSetSplice(commit, parent)) {
+            r = ctx.repo.commitParentSetFinish(tree, commit, parent);
+        
+        } else {
+            Index index = ctx.repo.commitParentSet(fileFavor, commit, parent);
+            const bool conflicts = index.conflicts();
+            _ConflictsHandle(ctx, fileFavor, index);
+            r = ctx.repo.commitParentSetFinish(index, commit, parent);
+            // Don't remember results that depend on how the user resolved conflicts
+            if (conflicts) return r;
+        }
+        
+        if (ctx.rewriteCache) ctx.rewriteCache->set(fileFavor, commit, parent, r);
+        return r;
     }
     
     static Commit _CommitIntegrate(const Ctx& ctx, git_merge_file_favor_t fileFavor, const Commit& dst, const Commit& src) {
+        _Progress(ctx);
+        
         Index index = ctx.repo.commitIntegrate(fileFavor, dst, src);
         _ConflictsHandle(ctx, fileFavor, index);
         return ctx.repo.commitIntegrateFinish(index, dst, src);
@@ -149,12 +232,15 @@ private:
         std::deque<CommitAdded> combined;
         Commit head;
         {
+            Ancestry& ancestry = Ancestry::ForRepo(ctx.repo);
             const bool adding = !addv.empty();
-            std::set<Commit> r = remove;
-            Commit c = dst;
+            const _Pos addPos = ancestry.pos(addPosition);
+            std::set<_Pos> r;
+            for (const Commit& c : remove) r.insert(ancestry.pos(c));
+            _Pos c = ancestry.pos(dst);
             bool foundAddPoint = false;
             for (;;) {
-                if (adding && c==addPosition) {
+                if (adding && c==addPos) {
                     assert(!foundAddPoint);
                     combined.insert(combined.begin(), addv.begin(), addv.end());
                     for (size_t i=0; i<addv.size(); i++) combined[i].added = true;
@@ -169,14 +255,15 @@ private:
                 // Therefore this check needs to occur after our break (above). So if we get to
                 // this point and we didn't break, but c==null, then we exhausted our one
                 // c==null iteration and have a problem.
-                assert(c);
-                if (!r.erase(c)) combined.push_front(c);
-                c = c.parent();
+                assert(c != Ancestry::PosNull);
+                // Only commits that we're going to re-apply need to be loaded
+                if (!r.erase(c)) combined.push_front(ctx.repo.commitLookup(ancestry.id(c)));
+                c = ancestry.parent(c);
             }
             assert(!adding || foundAddPoint);
             assert(r.empty());
             
-            head = c;
+            head = (c!=Ancestry::PosNull ? ctx.repo.commitLookup(ancestry.id(c)) : nullptr);
         }
         
         // Apply `combined` on top of `head`, and keep track of the added commits
@@ -195,15 +282,93 @@ private:
         };
     }
     
+    // _Rehome(): returns the equivalent of the given commit(s), owned by `repo`
+    static Commit _Rehome(const Repo& repo, const Commit& commit) {
+        if (!commit) return nullptr;
+        return repo.commitLookup(commit.id());
+    }
+    
+    static std::set<Commit> _Rehome(const Repo& repo, const std::set<Commit>& commits) {
+        std::set<Commit> r;
+        for (const Commit& c : commits) r.insert(_Rehome(repo, c));
+        return r;
+    }
+    
+    static _AddRemoveResult _Rehome(const Repo& repo, const _AddRemoveResult& x) {
+        return {
+            .commit = _Rehome(repo, x.commit),
+            .added = _Rehome(repo, x.added),
+        };
+    }
+    
+    // _AddRemoveCommitsConcurrently(): executes `a` and `b` simultaneously, and returns
+    // their results
+    // A Repo can't be used by multiple threads at once, so each function is given a
+    // Ctx with its own handle to the repository (see Repo::reopen()), and must only use
+    // commits owned by that handle (see _Rehome()). Ctx's callbacks are serialized, and
+    // if either function fails, the other one is canceled at its next progress() call.
+    static std::pair<_AddRemoveResult,_AddRemoveResult> _AddRemoveCommitsConcurrently(
+        const Ctx& ctx,
+        const std::function<_AddRemoveResult(const Ctx&)>& a,
+        const std::function<_AddRemoveResult(const Ctx&)>& b
+    ) {
+        std::mutex lock;
+        std::atomic<bool> abort = false;
+        std::exception_ptr err;
+        
+        const auto ctxCreate = [&] {
+            Ctx x = ctx;
+            x.repo = ctx.repo.reopen();
+            x.spawn = [&] (const char*const* argv) {
+                auto l = std::unique_lock(lock);
+                ctx.spawn(argv);
+            };
+            x.conflictsResolve = [&] (const Index& index, const std::vector<Conflict>& fcs) {
+                auto l = std::unique_lock(lock);
+                ctx.conflictsResolve(index, fcs);
+            };
+            x.progress = [&] {
+                auto l = std::unique_lock(lock);
+                if (abort) throw Canceled();
+                _Progress(ctx);
+            };
+            return x;
+        };
+        
+        // Executes `fn`, remembering the first error to occur across both threads
+        const auto run = [&] (const std::function<_AddRemoveResult(const Ctx&)>& fn, const Ctx& ctx) {
+            std::optional<_AddRemoveResult> r;
+            try {
+                r = fn(ctx);
+            } catch (...) {
+                auto l = std::unique_lock(lock);
+                if (!err) err = std::current_exception();
+                abort = true;
+            }
+            return r;
+        };
+        
+        const Ctx ctxA = ctxCreate();
+        const Ctx ctxB = ctxCreate();
+        std::optional<_AddRemoveResult> resultB;
+        std::thread thread([&] { resultB = run(b, ctxB); });
+        const std::optional<_AddRemoveResult> resultA = run(a, ctxA);
+        thread.join();
+        
+        if (err) std::rethrow_exception(err);
+        // Transfer ownership of the results to `ctx.repo`, since the handles that
+        // created them are destroyed when we return
+        return { _Rehome(ctx.repo, *resultA), _Rehome(ctx.repo, *resultB) };
+    }
+    
     static bool _CommitsHasGap(const Commit& head, const std::set<Commit>& commits) {
-        Commit h = head;
-        std::set<Commit> rem = commits;
+        Ancestry& ancestry = Ancestry::ForCommit(head);
+        std::map<_Pos,Commit> rem = _Positions(ancestry, commits);
         bool started = false;
-        while (h && !rem.empty()) {
+        for (_Pos h=ancestry.pos(head); h!=Ancestry::PosNull && !rem.empty(); h=ancestry.parent(h)) {
             bool found = rem.erase(h);
             if (started && !found) return true;
             started |= found;
-            h = h.parent();
         }
         // If `rem` still has elements, then it's because `commits` contains
         // elements that don't exist in the `head` tree
@@ -277,15 +442,12 @@ private:
                 op.src.commits      // remove:      std::set<Commit>
             );
             
-            // Replace the branch/tag
-            T_Rev dstRev = op.dst.rev;
-            (Rev&)dstRev = ctx.refReplace(dstRev.ref, srcDstResult.commit);
             return OpResult{
                 .src = {
                     .rev = op.src.rev,
                 },
                 .dst = {
-                    .rev = dstRev,
+                    .rev = _RevReplace(op.dst.rev, srcDstResult.commit),
                     .selection = srcDstResult.added,
                     .selectionPrev = op.src.commits,
                 },
@@ -293,49 +455,52 @@ private:
         
         // Move commits between different refs (branches/tags)
         } else {
-            // Remove commits from `op.src`
-            _AddRemoveResult srcResult = _AddRemoveCommits(
-                ctx,
-                _FileFavor(op.src.rev, {}), // Second argument empty because deletion happens within
-                                            // the same ref, so there's no 'destination' for the
-                                            // deletion.
-                                            // More concretely, we want to use fileFavor==_THEIRS
-                                            // to avoid conflicts on the deletion side.
-                op.src.rev.commit,  // dst:         Commit
-                {},                 // add:         std::set<Commit>
-                nullptr,            // addSrc:      Commit
-                nullptr,            // addPosition: Commit
-                op.src.commits      // remove:      std::set<Commit>
+            // The removal from `op.src` and the addition to `op.dst` are independent,
+            // so perform them concurrently
+            const auto [srcResult, dstResult] = _AddRemoveCommitsConcurrently(ctx,
+                // Remove commits from `op.src`
+                [&] (const Ctx& ctx) {
+                    return _AddRemoveCommits(
+                        ctx,
+                        _FileFavor(op.src.rev, {}), // Second argument empty because deletion happens within
+                                                    // the same ref, so there's no 'destination' for the
+                                                    // deletion.
+                                                    // More concretely, we want to use fileFavor==_THEIRS
+                                                    // to avoid conflicts on the deletion side.
+                        _Rehome(ctx.repo, op.src.rev.commit),   // dst:         Commit
+                        {},                                     // add:         std::set<Commit>
+                        nullptr,                                // addSrc:      Commit
+                        nullptr,                                // addPosition: Commit
+                        _Rehome(ctx.repo, op.src.commits)       // remove:      std::set<Commit>
+                    );
+                },
+                
+                // Add commits to `op.dst`
+                [&] (const Ctx& ctx) {
+                    return _AddRemoveCommits(
+                        ctx,
+                        _FileFavor(op.src.rev, op.dst.rev),
+                        _Rehome(ctx.repo, op.dst.rev.commit),   // dst:         Commit
+                        _Rehome(ctx.repo, op.src.commits),      // add:         std::set<Commit>
+                        _Rehome(ctx.repo, op.src.rev.commit),   // addSrc:      Commit
+                        _Rehome(ctx.repo, op.dst.position),     // addPosition: Commit
+                        {}                                      // remove:      std::set<Commit>
+                    );
+                }
             );
             
             if (!srcResult.commit) {
                 throw RuntimeError("can't move last commit");
             }
             
-            // Add commits to `op.dst`
-            _AddRemoveResult dstResult = _AddRemoveCommits(
-                ctx,
-                _FileFavor(op.src.rev, op.dst.rev),
-                op.dst.rev.commit,  // dst:         Commit
-                op.src.commits,     // add:         std::set<Commit>
-                op.src.rev.commit,  // addSrc:      Commit
-                op.dst.position,    // addPosition: Commit
-                {}                  // remove:      std::set<Commit>
-            );
-            
-            // Replace the source and destination branches/tags
-            T_Rev srcRev = op.src.rev;
-            T_Rev dstRev = op.dst.rev;
-            (Rev&)srcRev = ctx.refReplace(srcRev.ref, srcResult.commit);
-            (Rev&)dstRev = ctx.refReplace(dstRev.ref, dstResult.commit);
             return OpResult{
                 .src = {
-                    .rev = srcRev,
+                    .rev = _RevReplace(op.src.rev, srcResult.commit),
                     .selection = {},
                     .selectionPrev = op.src.commits,
                 },
                 .dst = {
-                    .rev = dstRev,
+                    .rev = _RevReplace(op.dst.rev, dstResult.commit),
                     .selection = dstResult.added,
                     .selectionPrev = {},
                 },
@@ -361,15 +526,12 @@ private:
             {}                  // remove:      std::set<Commit>
         );
         
-        // Replace the destination branch/tag
-        T_Rev dstRev = op.dst.rev;
-        (Rev&)dstRev = ctx.refReplace(dstRev.ref, dstResult.commit);
         return OpResult{
             .src = {
                 .rev = op.src.rev,
             },
             .dst = {
-                .rev = dstRev,
+                .rev = _RevReplace(op.dst.rev, dstResult.commit),
                 .selection = dstResult.added,
                 .selectionPrev = {},
             },
@@ -399,12 +561,9 @@ private:
             throw RuntimeError("can't delete last commit");
         }
         
-        // Replace the source branch/tag
-        T_Rev srcRev = op.src.rev;
-        (Rev&)srcRev = ctx.refReplace(srcRev.ref, srcResult.commit);
         return OpResult{
             .src = {
-                .rev = srcRev,
+                .rev = _RevReplace(op.src.rev, srcResult.commit),
                 .selection = {},
                 .selectionPrev = op.src.commits,
             },
@@ -424,22 +583,41 @@ private:
         std::deque<Commit> integrate; // Commits that need to be integrated into a single commit
         std::deque<Commit> attach;    // Commits that need to be attached after the integrate step
         Commit head;
+        bool contiguous = true;       // Whether no unselected commits are interleaved with the selected ones
         {
-            std::set<Commit> rem = op.src.commits;
-            head = op.src.rev.commit;
+            Ancestry& ancestry = Ancestry::ForRepo(ctx.repo);
+            std::map<_Pos,Commit> rem = _Positions(ancestry, op.src.commits);
+            _Pos h = ancestry.pos(op.src.rev.commit);
             for (;;) {
-                if (!head) throw RuntimeError("ran out of commits");
-                bool erased = rem.erase(head);
-                if (rem.empty()) break;
-                if (erased) integrate.push_front(head);
-                else        attach.push_front(head);
-                head = head.parent();
+                if (h == Ancestry::PosNull) throw RuntimeError("ran out of commits");
+                auto it = rem.find(h);
+                const bool erased = (it != rem.end());
+                // Use the selected commit if possible, otherwise load it
+                const Commit c = (erased ? it->second : ctx.repo.commitLookup(ancestry.id(h)));
+                if (erased) rem.erase(it);
+                if (rem.empty()) {
+                    head = c;
+                    break;
+                }
+                if (erased) integrate.push_front(c);
+                else        attach.push_front(c);
+                // An unselected commit below a selected one is interleaved with the selection
+                if (!erased && !integrate.empty()) contiguous = false;
+                h = ancestry.parent(h);
             }
         }
         
-        // Combine `head` with all the commits in `integrate`
-        for (const Commit& commit : integrate) {
-            head = _CommitIntegrate(ctx, _FileFavor(op.src.rev, {}), head, commit);
+        if (contiguous) {
+            // Fast path: the selected commits are contiguous, so the combined tree is
+            // simply the tree of the newest commit, and no merging is necessary
+            _Progress(ctx);
+            head = ctx.repo.commitSquash(head, {integrate.begin(), integrate.end()});
+        
+        } else {
+            // Combine `head` with all the commits in `integrate`
+            for (const Commit& commit : integrate) {
+                head = _CommitIntegrate(ctx, _FileFavor(op.src.rev, {}), head, commit);
+            }
         }
         
         // Remember the final commit containing all the integrated commits
@@ -450,12 +628,9 @@ private:
             head = _CommitParentSet(ctx, _FileFavor(op.src.rev, {}), commit, head);
         }
         
-        // Replace the source branch/tag
-        T_Rev srcRev = op.src.rev;
-        (Rev&)srcRev = ctx.refReplace(srcRev.ref, head);
         return OpResult{
             .src = {
-                .rev = srcRev,
+                .rev = _RevReplace(op.src.rev, head),
                 .selection = {integrated},
                 .selectionPrev = op.src.commits,
             },
@@ -629,33 +804,71 @@ private:
             {origCommit}        // remove:      std::set<Commit>
         );
         
-        // Replace the source branch/tag
-        T_Rev srcRev = op.src.rev;
-        (Rev&)srcRev = ctx.refReplace(srcRev.ref, srcResult.commit);
         return OpResult{
             .src = {
-                .rev = srcRev,
+                .rev = _RevReplace(op.src.rev, srcResult.commit),
                 .selection = srcResult.added,
                 .selectionPrev = op.src.commits,
             },
         };
     }
     
+    static std::optional<OpResult> _OpExec(const Ctx& ctx, const Op& op) {
+        switch (op.type) {
+        case Op::Type::None:    return std::nullopt;
+        case Op::Type::Move:    return _MoveCommits(ctx, op);
+        case Op::Type::Copy:    return _CopyCommits(ctx, op);
+        case Op::Type::Delete:  return _DeleteCommits(ctx, op);
+        case Op::Type::Combine: return _CombineCommits(ctx, op);
+        case Op::Type::Edit:    return _EditCommit(ctx, op);
+        }
+        abort();
+    }
+    
+    static std::optional<OpResult> _Exec(const Ctx& ctx, const Op& op) {
+        // Stage every object that the operation creates in memory, so that they're written
+        // as a single packfile instead of as individual loose objects, and so that nothing
+        // is written if the operation is canceled or fails
+        Mempack mempack(ctx.repo);
+        // Forget the rewrites that we staged in the cache if the operation fails,
+        // because their results are discarded along with the mempack
+        Defer( if (ctx.rewriteCache) ctx.rewriteCache->reset() );
+        std::optional<OpResult> res = _OpExec(ctx, op);
+        if (!res) return std::nullopt;
+        
+        // Create the objects that the refs will target (eg new annotations for annotated
+        // tags) while the mempack is installed, so that they're written out with the rest
+        // of the staged objects
+        const bool srcReplace = _RevReplaceNeeded(op.src.rev, res->src.rev);
+        const bool dstReplace = _RevReplaceNeeded(op.dst.rev, res->dst.rev);
+        const Id srcTarget = (srcReplace ? ctx.repo.refTargetCreate(res->src.rev.ref, res->src.rev.commit) : Id{});
+        const Id dstTarget = (dstReplace ? ctx.repo.refTargetCreate(res->dst.rev.ref, res->dst.rev.commit) : Id{});
+        
+        // Refs can't point to objects that only exist in memory, so write out the
+        // staged objects before updating any refs
+        mempack.flush();
+        
+        // Update every ref that the operation modified in a single transaction, so that
+        // either all of them are updated or none are (eg a Move between two branches
+        // can't remove the commits from the source without adding them to the destination)
+        const Transaction tx = ctx.repo.transactionCreate();
+        if (srcReplace) ctx.refReplace(tx, res->src.rev.ref, res->src.rev.commit, srcTarget);
+        if (dstReplace) ctx.refReplace(tx, res->dst.rev.ref, res->dst.rev.commit, dstTarget);
+        ctx.repo.transactionCommit(tx);
+        if (ctx.rewriteCache) ctx.rewriteCache->flush();
+        
+        if (srcReplace) (Rev&)res->src.rev = ctx.repo.refReload(res->src.rev.ref);
+        if (dstReplace) (Rev&)res->dst.rev = ctx.repo.refReload(res->dst.rev.ref);
+        return res;
+    }
+    
 public:
     static std::optional<OpResult> Exec(const Ctx& ctx, const Op& op) {
         try {
-            switch (op.type) {
-            case Op::Type::None:    return std::nullopt;
-            case Op::Type::Move:    return _MoveCommits(ctx, op);
-            case Op::Type::Copy:    return _CopyCommits(ctx, op);
-            case Op::Type::Delete:  return _DeleteCommits(ctx, op);
-            case Op::Type::Combine: return _CombineCommits(ctx, op);
-            case Op::Type::Edit:    return _EditCommit(ctx, op);
-            }
-            abort();
+            return _Exec(ctx, op);
         
-        } catch (const ConflictResolveCanceled&) {
-            // Conflict resolution was canceled
+        } catch (const Canceled&) {
+            // The operation or conflict resolution was canceled
             return std::nullopt;
         
         } catch (...) {
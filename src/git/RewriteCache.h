@@ -0,0 +1,162 @@
+#pragma once
+#include <mutex>
+#include <map>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include "Git.h"
+
+namespace Git {
+
+// RewriteCache: remembers the result of rewriting a commit onto a new parent, so that
+// a rewrite that was already performed (eg by redoing a move after undoing it, or by
+// copying the same commits to several branches) is a lookup instead of a merge.
+//
+// Rewriting is deterministic -- the rewritten commit keeps the original's author,
+// committer and message, and its tree is a function of the commit, the new parent
+// and the merge's file favor -- so entries never go stale. An entry is only
+// useless if its result has since been garbage collected, which get() checks for.
+//
+// Entries are staged by set() and only persisted by flush(), which must be called
+// once the results have been written to the object database. reset() drops staged
+// entries, eg because the operation that created them failed.
+class RewriteCache {
+public:
+    RewriteCache() {}
+    RewriteCache(const std::filesystem::path& path) : _path(path) {}
+    
+    RewriteCache(const RewriteCache&) = delete;
+    RewriteCache& operator=(const RewriteCache&) = delete;
+    
+    // get(): returns the cached result of rewriting `commit` onto `parent`, or null
+    Commit get(const Repo& repo, git_merge_file_favor_t fileFavor, const Commit& commit, const Commit& parent) {
+        const _Key key = _KeyCreate(fileFavor, commit, parent);
+        Id result;
+        {
+            auto lock = std::unique_lock(_lock);
+            _load();
+            auto it = _staged.find(key);
+            if (it == _staged.end()) {
+                it = _entries.find(key);
+                if (it == _entries.end()) return nullptr;
+            }
+            result = it->second;
+        }
+        
+        // The result may have been garbage collected since it was cached
+        try {
+            return repo.commitLookup(result);
+        } catch (...) {
+            return nullptr;
+        }
+    }
+    
+    // set(): stages the result of rewriting `commit` onto `parent`
+    void set(git_merge_file_favor_t fileFavor, const Commit& commit, const Commit& parent, const Commit& result) {
+        auto lock = std::unique_lock(_lock);
+        _staged[_KeyCreate(fileFavor, commit, parent)] = result.id();
+    }
+    
+    // flush(): persists the staged entries
+    // Failing to write the cache isn't an error, so I/O errors are ignored.
+    void flush() {
+        auto lock = std::unique_lock(_lock);
+        if (_staged.empty()) return;
+        
+        if (!_path.empty()) {
+            std::error_code ec;
+            std::filesystem::create_directories(_path.parent_path(), ec);
+            std::ofstream f(_path, std::ios::app);
+            for (const auto& [key, result] : _staged) {
+                f << _Line(key, result) << '\n';
+            }
+        }
+        
+        _entries.insert(_staged.begin(), _staged.end());
+        _staged.clear();
+    }
+    
+    // reset(): drops the staged entries
+    void reset() {
+        auto lock = std::unique_lock(_lock);
+        _staged.clear();
+    }
+    
+private:
+    // Once the file has more entries than this, it's rewritten with the newest half
+    static constexpr size_t _EntryCountMax = 50000;
+    
+    struct _Key {
+        Id commit;
+        Id parent;
+        int fileFavor = 0;
+        
+        bool operator <(const _Key& x) const {
+            if (int c = git_oid_cmp(&commit, &x.commit)) return c < 0;
+            if (int c = git_oid_cmp(&parent, &x.parent)) return c < 0;
+            return fileFavor < x.fileFavor;
+        }
+    };
+    
+    static _Key _KeyCreate(git_merge_file_favor_t fileFavor, const Commit& commit, const Commit& parent) {
+        _Key key = { .commit = commit.id(), .fileFavor = (int)fileFavor };
+        if (parent) key.parent = parent.id();
+        return key;
+    }
+    
+    static std::string _Line(const _Key& key, const Id& result) {
+        std::stringstream s;
+        s << StringFromId(key.commit) << ' ' << StringFromId(key.parent) << ' ';
+        s << key.fileFavor << ' ' << StringFromId(result);
+        return s.str();
+    }
+    
+    // _load(): reads the persisted entries, the first time it's called
+    void _load() {
+        if (_loaded) return;
+        _loaded = true;
+        if (_path.empty()) return;
+        
+        std::vector<std::string> lines;
+        {
+            std::ifstream f(_path);
+            for (std::string line; std::getline(f, line);) {
+                std::istringstream s(line);
+                std::string commit, parent, result;
+                _Key key;
+                s >> commit >> parent >> key.fileFavor >> result;
+                // Ignore malformed entries (eg a partially-written line)
+                if (!s) continue;
+                if (git_oid_fromstrn(&key.commit, commit.c_str(), commit.size())) continue;
+                if (git_oid_fromstrn(&key.parent, parent.c_str(), parent.size())) continue;
+                Id id;
+                if (git_oid_fromstrn(&id, result.c_str(), result.size())) continue;
+                _entries[key] = id;
+                lines.push_back(line);
+            }
+        }
+        
+        // Keep the file from growing forever by dropping its oldest entries
+        if (lines.size() > _EntryCountMax) {
+            const std::filesystem::path tmp = _path.string() + ".tmp";
+            {
+                std::ofstream f(tmp);
+                for (auto it=lines.end()-_EntryCountMax/2; it!=lines.end(); it++) {
+                    f << *it << '\n';
+                }
+            }
+            std::error_code ec;
+            std::filesystem::rename(tmp, _path, ec);
+        }
+    }
+    
+    std::filesystem::path _path;
+    std::mutex _lock;
+    bool _loaded = false;
+    std::map<_Key,Id> _entries;
+    std::map<_Key,Id> _staged;
+};
+
+} // namespace Git
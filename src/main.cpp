@@ -3,7 +3,9 @@
 #include "state/StateDir.h"
 #include "lib/toastbox/Stringify.h"
 #include "lib/toastbox/String.h"
+#include "lib/toastbox/IntForStr.h"
 #include "App.h"
+#include "ui/NcursesBackend.h"
 #include "Terminal.h"
 #include "Debase.h"
 #include "DebaseGitHash.h"
@@ -15,6 +17,8 @@
 struct _Args {
     struct {
         bool en = false;
+        bool lowBandwidth = false;
+        unsigned frameRate = 0; // Frames per second; 0 = Screen's default
         std::vector<std::string> revs;
     } run;
     
@@ -32,15 +36,42 @@ struct _Args {
     } libs;
 };
 
+static constexpr unsigned _FrameRateMin = 1;
+static constexpr unsigned _FrameRateMax = 1000;
+
 static _Args _ParseArgs(int argc, const char* argv[]) {
     using namespace Toastbox;
     
     std::vector<std::string> strs;
     for (int i=0; i<argc; i++) strs.push_back(argv[i]);
     
+    // --low-bandwidth and --frame-rate can precede the revs to open
+    bool lowBandwidth = false;
+    unsigned frameRate = 0;
+    while (!strs.empty()) {
+        if (strs[0] == "--low-bandwidth") {
+            lowBandwidth = true;
+            strs.erase(strs.begin());
+        
+        } else if (strs[0] == "--frame-rate") {
+            if (strs.size() < 2) throw std::runtime_error("no frame rate specified");
+            try {
+                frameRate = IntForStr<unsigned>(strs[1]);
+            } catch (...) {}
+            if (frameRate<_FrameRateMin || frameRate>_FrameRateMax) {
+                throw RuntimeError("invalid frame rate: %s (must be %u-%u)",
+                    strs[1].c_str(), _FrameRateMin, _FrameRateMax);
+            }
+            strs.erase(strs.begin(), strs.begin()+2);
+        
+        } else {
+            break;
+        }
+    }
+    
     _Args args;
     if (strs.size() < 1) {
-        return _Args{ .run = {.en = true}, };
+        return _Args{ .run = {.en = true, .lowBandwidth = lowBandwidth, .frameRate = frameRate}, };
     }
     
     std::string arg0 = strs[0];
@@ -73,6 +104,8 @@ static _Args _ParseArgs(int argc, const char* argv[]) {
     return _Args{
         .run = {
             .en = true,
+            .lowBandwidth = lowBandwidth,
+            .frameRate = frameRate,
             .revs = strs,
         },
     };
@@ -111,51 +144,6 @@ static void _StdinFlush(std::chrono::steady_clock::duration timeout) {
 //    return PathIsInEnvironmentPath(CurrentExecutablePath().parent_path());
 //}
 
-Rev _RevLookup(const Git::Repo& repo, const std::string& str) {
-    Rev rev;
-    (Git::Rev&)rev = repo.revLookup(str);
-    if (rev.ref) return rev;
-    
-    // Try to get a ref-backed rev (with skip parameter) by removing the ^ or ~ suffix from `str`
-    Rev skipRev;
-    {
-        std::string name(str);
-        size_t pos = name.find("^");
-        if (pos != std::string::npos) {
-            name.erase(pos);
-            (Git::Rev&)skipRev = repo.revLookup(name);
-        }
-    }
-    
-    if (!skipRev.ref) {
-        std::string name(str);
-        size_t pos = name.find("~");
-        if (pos != std::string::npos) {
-            name.erase(pos);
-            (Git::Rev&)skipRev = repo.revLookup(name);
-        }
-    }
-    
-    // If we found a `skipRev.ref` by removing the ^~ suffix, calculate the `skip` value
-    if (skipRev.ref) {
-        size_t skip = 0;
-        Git::Commit head = skipRev.commit;
-        while (head && head!=rev.commit) {
-            head = head.parent();
-            skip++;
-        }
-        
-        if (head) {
-            skipRev.skip = skip;
-            return skipRev;
-        }
-    }
-    
-    // We couldn't parse `str` directly as a ref, nor could we parse it as "ref+skip" (ie rev^ / rev~X).
-    // So just return the commit itself.
-    return rev;
-}
-
 int main(int argc, const char* argv[]) {
     #warning TODO: linux:       run through TestChecklist.txt
     #warning TODO: macos-x86:   run through TestChecklist.txt
@@ -183,8 +171,6 @@ int main(int argc, const char* argv[]) {
     #warning TODO:   need to handle tabs properly -- do the de-indenting after filtering the text (which replaces
     #warning TODO:   tabs with spaces)
     
-    #warning TODO: add scrolling
-    
     #warning TODO: integrate debase-releases as a submodule into debase.
     #warning TODO: invoke with `make release`; its tasks are:
     #warning TODO:   - in the debase repo: create a tag `v<VersionNumber>`
@@ -199,10 +185,6 @@ int main(int argc, const char* argv[]) {
     
     #warning TODO: move commits away from dragged commits to show where the commits will land
     
-    #warning TODO: add column scrolling
-    
-    #warning TODO: if we cant speed up git operations, show a progress indicator
-    
     #warning TODO: figure out why moving/copying commits is slow sometimes
     
     try {
@@ -287,14 +269,15 @@ int main(int argc, const char* argv[]) {
                 }
                 
                 // Fill out `revs` with recent revs that were checked out, until we hit `RevCountDefault`
-                Git::Reflog reflog = repo.reflogForRef(repo.head());
-                for (size_t i=0; revs.size()<RevCountDefault; i++) {
-                    const git_reflog_entry*const entry = reflog[i];
+                // Only the entries that we need are read, starting from the end of the reflog
+                Git::ReflogTail reflog = repo.reflogTailForRef(repo.head());
+                while (revs.size() < RevCountDefault) {
+                    const std::optional<Git::ReflogTail::Entry> entry = reflog.next();
                     if (!entry) break; // End of reflog
                     
                     try {
                         Rev rev;
-                        (Git::Rev&)rev = repo.reflogRevForCheckoutEntry(entry);
+                        (Git::Rev&)rev = repo.reflogRevForCheckoutEntry(*entry);
                         // Ignore non-ref reflog entries
                         if (!rev.ref) continue;
                         const auto [_, inserted] = unique.insert(rev);
@@ -311,7 +294,7 @@ int main(int argc, const char* argv[]) {
                 for (const std::string& revName : args.run.revs) {
                     Rev rev;
                     try {
-                        rev = _RevLookup(repo, revName);
+                        rev = RevLookup(repo, revName);
                     } catch (...) {
                         throw Toastbox::RuntimeError("invalid rev: %s", revName.c_str());
                     }
@@ -324,7 +307,13 @@ int main(int argc, const char* argv[]) {
             }
         }
         
-        auto app = std::make_shared<App>(repo, revs);
+        auto backend = std::make_shared<UI::NcursesBackend>();
+        backend->lowBandwidth(args.run.lowBandwidth);
+        
+        auto app = std::make_shared<App>(repo, revs, backend);
+        if (args.run.frameRate) {
+            app->frameInterval(std::chrono::microseconds(1000000/args.run.frameRate));
+        }
         app->run();
     
     } catch (const std::exception& e) {
@@ -390,6 +390,9 @@ private:
     _Path _repoStateDir;
     Git::Repo _repo;
     
+    // _stored: the state that was read from disk, from which refs are loaded as
+    // they're accessed
+    _RepoState _stored;
     std::map<Ref,_LoadedRef> _loadedRefs;
     
     static _Path _RepoStateDirPath(_Path dir, Git::Repo repo) {
@@ -436,7 +439,7 @@ private:
         return r;
     }
     
-    _LoadedRef& _loadRef(const Git::Ref& ref, const _RefState* refState=nullptr) {
+    _LoadedRef& _loadRef(const Git::Ref& ref) {
         const Ref cref = Convert(ref);
         
         auto [it, inserted] = _loadedRefs.insert({cref, {}});
@@ -444,6 +447,8 @@ private:
         if (!inserted) return it->second;
         
         _LoadedRef& lref = it->second;
+        const auto find = _stored.refStates.find(cref);
+        const _RefState* refState = (find!=_stored.refStates.end() ? &find->second : nullptr);
         
         if (refState) {
             lref.refState = *refState;
@@ -487,22 +492,14 @@ private:
     
 public:
     RepoState() {}
-    RepoState(_Path rootDir, Git::Repo repo, const std::set<Git::Ref>& refs) :
+    // Refs are loaded when they're first accessed, so a ref must be accessed (eg
+    // via history()) before it's modified, in order to capture its initial state
+    RepoState(_Path rootDir, Git::Repo repo) :
     _rootDir(rootDir), _repoStateDir(_RepoStateDirPath(_rootDir, repo)), _repo(repo) {
         
         // Read existing state
         Toastbox::FDStreamInOut versionLockFile = State::AcquireVersionLock(_rootDir, false);
-        _RepoState repoState;
-        _RepoStateRead(_RepoStateFilePath(_repoStateDir), repoState);
-        
-        for (const Git::Ref& ref : refs) {
-            const _RefState* refState = nullptr;
-            const auto find = repoState.refStates.find(Convert(ref));
-            if (find != repoState.refStates.end()) {
-                refState = &find->second;
-            }
-            _loadRef(ref, refState);
-        }
+        _RepoStateRead(_RepoStateFilePath(_repoStateDir), _stored);
     }
     
     void write() {
@@ -578,6 +575,16 @@ public:
     Git::Repo repo() const {
         return _repo;
     }
+    
+    // rewriteCachePath(): path of the repo's Git::RewriteCache
+    _Path rewriteCachePath() const {
+        return _repoStateDir / "RewriteCache";
+    }
+    
+    // commitInfoCachePath(): path of the repo's Git::CommitInfoArena cache file
+    _Path commitInfoCachePath() const {
+        return _repoStateDir / "CommitInfoCache";
+    }
 };
 
 } // namespace State
@@ -4,7 +4,7 @@
 
 namespace State {
 
-Theme ThemeRead() {
+inline Theme ThemeRead() {
     State state(StateDir());
     Theme theme = state.theme();
     if (theme != Theme::None) return theme;
@@ -36,7 +36,7 @@ Theme ThemeRead() {
     return theme;
 }
 
-static void ThemeWrite(Theme theme) {
+inline void ThemeWrite(Theme theme) {
     State state(StateDir());
     state.theme(theme);
     state.write();
@@ -136,8 +136,6 @@ public:
 //        drawRect(r);
 //        borderColor(_color);
         _title->textAttr(_color|WA_BOLD);
-        // Always redraw _title because our border may have clobbered it
-        _title->drawNeeded(true);
         
         // Set the highlight color of all button subviews
         // This is generic (instead of accessing _okButton/_dismissButton directly) so
@@ -145,9 +143,9 @@ public:
         // for their own buttons
         auto it = subviewsBegin();
         for (;;) {
-            ViewPtr subview = subviewsNext(it);
+            View* subview = subviewsNext(it);
             if (!subview) break;
-            if (ButtonPtr button = std::dynamic_pointer_cast<Button>(subview)) {
+            if (Button* button = dynamic_cast<Button*>(subview)) {
                 button->highlightColor(_color);
             }
         }
@@ -172,10 +170,13 @@ public:
             if (bottom) drawLineHoriz({ 0,        b.b()-1 }, w);
             
             // Draw the corners that aren't clipped
-            if (left && top)     mvwaddch(window(), 0,       0,       ACS_ULCORNER);
-            if (right && top)    mvwaddch(window(), 0,       b.r()-1, ACS_URCORNER);
-            if (left && bottom)  mvwaddch(window(), b.b()-1, 0,       ACS_LLCORNER);
-            if (right && bottom) mvwaddch(window(), b.b()-1, b.r()-1, ACS_LRCORNER);
+            if (left && top)     drawGlyph({ 0,        0       }, Glyph::CornerUL);
+            if (right && top)    drawGlyph({ b.r()-1,  0       }, Glyph::CornerUR);
+            if (left && bottom)  drawGlyph({ 0,        b.b()-1 }, Glyph::CornerLL);
+            if (right && bottom) drawGlyph({ b.r()-1,  b.b()-1 }, Glyph::CornerLR);
+            
+            // Subviews that overlap our border (eg _title) need to be redrawn on top of it
+            for (const Rect& r : BorderRects(bounds())) _damageAdd(r);
             
 //            {
 //                Attr color = attr(_color);
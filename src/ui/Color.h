@@ -2,12 +2,10 @@
 #include <atomic>
 #include <vector>
 #include "lib/toastbox/RuntimeError.h"
+#include "RenderBackend.h"
 
 namespace UI {
 
-using ColorIdx       = NCURSES_COLOR_T;
-using ColorPairIdx   = NCURSES_PAIRS_T;
-
 // ColorPair: represents an ncurses color pair
 struct ColorPair {
     ColorPairIdx idx = WhiteOnBlackIdx;
@@ -22,6 +20,9 @@ struct ColorPair {
 
 class ColorPalette {
 public:
+    ColorPalette() {}
+    ColorPalette(RenderBackend& backend) : _backend(&backend) {}
+    
     ColorPair normal;
     ColorPair dimmed;
     ColorPair selection;
@@ -52,7 +53,8 @@ public:
 //    }
     
     ColorIdx colorNew(uint8_t r, uint8_t g, uint8_t b) {
-        _colorIdxSwappers.emplace_back(_colorIdx,
+        assert(_backend);
+        _colorIdxSwappers.emplace_back(*_backend, _colorIdx,
             ((_ColorComponent)r*1000)/255,
             ((_ColorComponent)g*1000)/255,
             ((_ColorComponent)b*1000)/255
@@ -61,7 +63,8 @@ public:
     }
     
     ColorPair pairNew(ColorIdx fg, ColorIdx bg=_ColorIdxNone) {
-        _colorPairSwappers.emplace_back(_colorPairIdx, fg, bg);
+        assert(_backend);
+        _colorPairSwappers.emplace_back(*_backend, _colorPairIdx, fg, bg);
         return _colorPairIdx++;
     }
     
@@ -75,7 +78,7 @@ private:
     // but also the value of a color component. See color_content() for
     // proof -- the first argument is a color index, and the remaining
     // arguments are the color components, but they all have the same type.
-    using _ColorComponent = NCURSES_COLOR_T;
+    using _ColorComponent = ColorComponent;
     
 //    // _ColorIdx: represents an ncurses color
 //    struct _ColorIdx {
@@ -91,14 +94,14 @@ private:
     class _ColorIdxSwapper {
     public:
         _ColorIdxSwapper() {}
-        _ColorIdxSwapper(ColorIdx idx, _ColorComponent r, _ColorComponent g, _ColorComponent b) : _s{.idx=idx} {
+        _ColorIdxSwapper(RenderBackend& backend, ColorIdx idx, _ColorComponent r, _ColorComponent g, _ColorComponent b) : _s{.backend=&backend, .idx=idx} {
             // Remember the previous RGB values for color index `idx`
-            int ir = ::color_content(*_s.idx, &_s.r, &_s.g, &_s.b);
-            if (ir != OK) throw std::runtime_error("color_content() failed");
+            bool br = _s.backend->colorGet(*_s.idx, _s.r, _s.g, _s.b);
+            if (!br) throw std::runtime_error("colorGet() failed");
             
             // Set the new RGB values for color index `idx`
-            ir = ::init_color(*_s.idx, r, g, b);
-            if (ir != OK) throw std::runtime_error("init_color() failed");
+            br = _s.backend->colorSet(*_s.idx, r, g, b);
+            if (!br) throw std::runtime_error("colorSet() failed");
         }
         
         _ColorIdxSwapper(const _ColorIdxSwapper& x) = delete;
@@ -113,12 +116,13 @@ private:
         
         ~_ColorIdxSwapper() {
             if (_s.idx) {
-                ::init_color(*_s.idx, _s.r, _s.g, _s.b);
+                _s.backend->colorSet(*_s.idx, _s.r, _s.g, _s.b);
             }
         }
         
     private:
         struct {
+            RenderBackend* backend = nullptr;
             std::optional<ColorIdx> idx;
             _ColorComponent r = -1;
             _ColorComponent g = -1;
@@ -131,14 +135,14 @@ private:
     class _ColorPairSwapper {
     public:
         _ColorPairSwapper() {}
-        _ColorPairSwapper(const ColorPair& pair, ColorIdx fg, ColorIdx bg) : _s{.pair=pair} {
+        _ColorPairSwapper(RenderBackend& backend, const ColorPair& pair, ColorIdx fg, ColorIdx bg) : _s{.backend=&backend, .pair=pair} {
             // Remember the previous fg/bg colors for the color pair c.idx
-            int ir = ::pair_content(_s.pair->idx, &_s.fg, &_s.bg);
-            if (ir != OK) throw std::runtime_error("pair_content() failed");
+            bool br = _s.backend->pairGet(_s.pair->idx, _s.fg, _s.bg);
+            if (!br) throw std::runtime_error("pairGet() failed");
             
             // Set the new RGB values for the color `c.idx`
-            ir = ::init_pair(_s.pair->idx, fg, bg);
-            if (ir != OK) throw std::runtime_error("init_pair() failed");
+            br = _s.backend->pairSet(_s.pair->idx, fg, bg);
+            if (!br) throw std::runtime_error("pairSet() failed");
         }
         
         _ColorPairSwapper(const _ColorPairSwapper& x) = delete;
@@ -154,12 +158,13 @@ private:
         
         ~_ColorPairSwapper() {
             if (_s.pair) {
-                ::init_pair(_s.pair->idx, _s.fg, _s.bg);
+                _s.backend->pairSet(_s.pair->idx, _s.fg, _s.bg);
             }
         }
         
     private:
         struct {
+            RenderBackend* backend = nullptr;
             std::optional<ColorPair> pair;
             ColorIdx fg = _ColorIdxNone;
             ColorIdx bg = _ColorIdxNone;
@@ -176,6 +181,7 @@ private:
     // likely to be used.
     static constexpr ColorIdx _ColorIdxInit = 16;
 
+    RenderBackend* _backend = nullptr;
     ColorIdx _colorIdx = _ColorIdxInit;
     ColorPairIdx _colorPairIdx = 1;
     
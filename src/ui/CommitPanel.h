@@ -1,6 +1,7 @@
 #pragma once
 #include <optional>
 #include "git/Git.h"
+#include "git/CommitInfo.h"
 #include "Panel.h"
 #include "Color.h"
 #include "LineWrap.h"
@@ -113,25 +114,18 @@ public:
         _id->textAttr(color|WA_BOLD);
         
         _mergeSymbol->textAttr(color);
-        
-//        #warning TODO: revisit
-        // Always redraw _time/_id/_mergeSymbol because our border may have clobbered them
-        _time->drawNeeded(true);
-        _id->drawNeeded(true);
-        _mergeSymbol->drawNeeded(true);
     }
     
-    const auto& commit() const { return _commit; }
-    template <typename T> bool commit(const T& x) {
-        if (!_set(_commit, x)) return false;
+    const Git::CommitInfo& commit() const { assert(_commit); return *_commit; }
+    bool commit(const Git::CommitInfo& x) {
+        if (!_set(_commit, &x)) return false;
         
-        const Git::Signature sig = _commit.author();
-        _id->text(Git::DisplayStringForId(_commit.id(), _CommitIdWidth));
-        _time->text(Git::ShortStringForTime(Git::TimeForGitTime(sig.time())));
-        _author->text(sig.name());
-        _message->text(_commit.message());
+        _id->text(Git::DisplayStringForId(_commit->id, _CommitIdWidth));
+        _time->text(Git::ShortStringForTime(_commit->time));
+        _author->text(std::string(_commit->author));
+        _message->text(std::string(_commit->summary));
         
-        _mergeSymbol->visible(_commit.isMerge());
+        _mergeSymbol->visible(_commit->isMerge());
         return true;
     }
     
@@ -140,10 +134,10 @@ public:
     
 private:
     static constexpr int _CommitIdWidth = 7;
-    static constexpr int _MessageLineCountMax = 2;
+    static constexpr int _MessageLineCountMax = Git::CommitInfoArena::SummaryLineCountMax;
     static constexpr int _TextInset = 2;
     
-    Git::Commit _commit;
+    const Git::CommitInfo* _commit = nullptr;
     LabelPtr _header        = subviewCreate<Label>();
     LabelPtr _id            = subviewCreate<Label>();
     LabelPtr _time          = subviewCreate<Label>();
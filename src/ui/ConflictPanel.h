@@ -127,9 +127,6 @@ public:
     void draw() override {
         View::draw();
         
-        // Always redraw _title because our border may have clobbered it
-        _title->drawNeeded(true);
-        
         const Rect b = bounds();
         const int separatorX = _SeparatorX(b);
         const Rect contentRectLeft = _ContentRectLeft(b);
@@ -277,10 +274,12 @@ private:
                     i += spaceCountLimited;
                 }
             
-            // Handle non-ascii UTF8 codepoints
+            // Handle non-ascii UTF8 codepoints, which may be wide
             } else {
+                const size_t w = UTF8::Width(std::string_view(&*it, itNext-it));
+                if (i+w > len) break;
                 buf.insert(buf.end(), it, itNext);
-                i++;
+                i += w;
             }
             
             it = itNext;
@@ -0,0 +1,396 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <array>
+#include <algorithm>
+#include <cassert>
+#include <thread>
+#include "RenderBackend.h"
+#include "UTF8.h"
+
+namespace UI {
+
+// HeadlessBackend: renders into an in-memory cell grid instead of a terminal, and reads
+// input from a queue of events supplied by the client
+// This allows the UI to run in-process without a tty, so that layout and drawing can
+// be measured, and the resulting frames can be inspected.
+class HeadlessBackend : public RenderBackend {
+public:
+    struct Cell {
+        char32_t ch = ' '; // 0: covered by the wide character to the left
+        attr_t attr = 0;
+        
+        bool operator ==(const Cell& x) const { return ch==x.ch && attr==x.attr; }
+        bool operator !=(const Cell& x) const { return !(*this == x); }
+    };
+    
+    // Frame: the composited contents of the screen, as of the last present()
+    struct Frame {
+        Size size;
+        std::vector<Cell> cells;
+        CursorState cursor;
+        
+        const Cell& cell(const Point& p) const {
+            return cells.at(p.y*size.x + p.x);
+        }
+        
+        // line(): returns the text of row `y`, as UTF-8
+        std::string line(int y) const {
+            std::string r;
+            for (int x=0; x<size.x; x++) {
+                const char32_t ch = cell({x,y}).ch;
+                if (ch) UTF8::Encode(ch, r);
+            }
+            return r;
+        }
+        
+        // text(): returns the text of every row, separated by newlines
+        std::string text() const {
+            std::string r;
+            for (int y=0; y<size.y; y++) {
+                r += line(y);
+                r += '\n';
+            }
+            return r;
+        }
+        
+        bool operator ==(const Frame& x) const {
+            return size==x.size && cells==x.cells &&
+                cursor.visible==x.cursor.visible && cursor.origin==x.cursor.origin;
+        }
+        bool operator !=(const Frame& x) const { return !(*this == x); }
+    };
+    
+    HeadlessBackend(const Size& size={80,24}) : _size(size) {}
+    
+    ~HeadlessBackend() {
+        // Surfaces must not outlive us, since they reference us
+        assert(!_screen);
+        assert(_panels.empty());
+    }
+    
+    // MARK: - Client Interface
+    
+    // eventPush(): queues an event to be returned by eventRead()
+    // Mouse events' `mouse.origin` is in screen coordinates.
+    void eventPush(const Event& ev) {
+        _events.push_back(ev);
+    }
+    
+    // screenSize(): changes the size of the screen, and queues a WindowResize event,
+    // like a terminal that was resized
+    const Size& screenSize() const { return _size; }
+    void screenSize(const Size& x) {
+        _size = x;
+        if (_screen) _screen->_resize(x);
+        // Like ncurses, shrink panels that no longer fit on the screen
+        for (_Surface* panel : _panels) {
+            const Point o = panel->_origin;
+            const Size s = panel->_size;
+            panel->_resize({std::min(s.x, std::max(1, x.x-o.x)), std::min(s.y, std::max(1, x.y-o.y))});
+        }
+        eventPush({.type = Event::Type::WindowResize});
+    }
+    
+    const Frame& frame() const { return _frame; }
+    size_t frameCount() const { return _frameCount; }
+    size_t beepCount() const { return _beepCount; }
+    
+    // MARK: - RenderBackend
+    
+    void init() override {}
+    void deinit() override {}
+    
+    SurfacePtr surfaceScreen() override {
+        assert(!_screen);
+        auto surface = std::make_unique<_Surface>(*this, Surface::Type::Window, _size);
+        _screen = surface.get();
+        return surface;
+    }
+    
+    SurfacePtr surfaceCreate(Surface::Type type) override {
+        return std::make_unique<_Surface>(*this, type, _size);
+    }
+    
+    void present(const CursorState& cursor) override {
+        _frame.size = _size;
+        _frame.cells.assign(_size.x*_size.y, Cell{});
+        _frame.cursor = cursor;
+        
+        if (_screen) _composite(*_screen);
+        for (const _Surface* panel : _panels) {
+            if (!panel->_hidden) _composite(*panel);
+        }
+        
+        // Surfaces overlapping each other can split wide characters, so replace the
+        // orphaned halves with spaces
+        for (int y=0; y<_size.y; y++) {
+            for (int x=0; x<_size.x; x++) {
+                Cell& c = _frame.cells[y*_size.x + x];
+                const bool wide = c.ch && UTF8::CodepointWidth(c.ch)>1;
+                const bool contOk = x+1<_size.x && !_frame.cells[y*_size.x + x+1].ch;
+                if (wide && !contOk) c.ch = ' ';
+                else if (wide) x++;
+                else if (!c.ch) c.ch = ' ';
+            }
+        }
+        
+        _frameCount++;
+    }
+    
+    // eventRead(): returns the next queued event
+    // Once the queue is empty, waits for `timeoutMs` like a terminal without input would,
+    // or returns KeyCtrlC if the wait is indefinite, so that the UI exits once it has
+    // consumed its input.
+    Event eventRead(int timeoutMs) override {
+        if (!_events.empty()) {
+            const Event ev = _events.front();
+            _events.pop_front();
+            return ev;
+        }
+        
+        if (timeoutMs < 0) return {.type = Event::Type::KeyCtrlC};
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+        return {};
+    }
+    
+    void beep() override {
+        _beepCount++;
+    }
+    
+    bool colorsChangeable() const override { return true; }
+    
+    bool colorGet(ColorIdx idx, ColorComponent& r, ColorComponent& g, ColorComponent& b) override {
+        const auto it = _colors.find(idx);
+        const std::array<ColorComponent,3> rgb = (it!=_colors.end() ? it->second : std::array<ColorComponent,3>{});
+        r = rgb[0];
+        g = rgb[1];
+        b = rgb[2];
+        return true;
+    }
+    
+    bool colorSet(ColorIdx idx, ColorComponent r, ColorComponent g, ColorComponent b) override {
+        _colors[idx] = {r, g, b};
+        return true;
+    }
+    
+    bool pairGet(ColorPairIdx idx, ColorIdx& fg, ColorIdx& bg) override {
+        const auto it = _pairs.find(idx);
+        const std::array<ColorIdx,2> p = (it!=_pairs.end() ? it->second : std::array<ColorIdx,2>{-1,-1});
+        fg = p[0];
+        bg = p[1];
+        return true;
+    }
+    
+    bool pairSet(ColorPairIdx idx, ColorIdx fg, ColorIdx bg) override {
+        _pairs[idx] = {fg, bg};
+        return true;
+    }
+    
+private:
+    class _Surface : public Surface {
+    public:
+        _Surface(HeadlessBackend& backend, Type type, const Size& size) : _backend(backend), _type(type) {
+            _resize(size);
+            // Like ncurses, new panels are placed on top
+            if (_type == Type::Panel) _backend._panels.push_back(this);
+        }
+        
+        ~_Surface() {
+            if (_type == Type::Panel) {
+                auto& panels = _backend._panels;
+                panels.erase(std::find(panels.begin(), panels.end(), this));
+            }
+            if (_backend._screen == this) _backend._screen = nullptr;
+        }
+        
+        Point origin() const override { return _origin; }
+        bool origin(const Point& p) override {
+            // Like ncurses, refuse to move the surface if it would extend beyond the screen
+            const Size screen = _backend._size;
+            if (p.x<0 || p.y<0 || p.x+_size.x>screen.x || p.y+_size.y>screen.y) return false;
+            _origin = p;
+            return true;
+        }
+        
+        Size size() const override { return _size; }
+        bool size(const Size& s) override {
+            if (s.x<=0 || s.y<=0) return false;
+            _resize(s);
+            return true;
+        }
+        
+        bool visible() const override { return !_hidden; }
+        void visible(bool x) override {
+            assert(_type == Type::Panel);
+            _hidden = !x;
+            // Like ncurses, showing a panel places it on top
+            if (x) orderFront();
+        }
+        
+        void orderFront() override {
+            if (_type != Type::Panel) return;
+            auto& panels = _backend._panels;
+            panels.erase(std::find(panels.begin(), panels.end(), this));
+            panels.push_back(this);
+        }
+        
+        void attrOn(attr_t attr) override {
+            if (attr & A_COLOR) _attr &= ~A_COLOR;
+            _attr |= attr;
+        }
+        
+        void attrOff(attr_t attr) override {
+            _attr &= ~attr;
+            if (attr & A_COLOR) _attr &= ~A_COLOR;
+        }
+        
+        void erase() override {
+            std::fill(_cells.begin(), _cells.end(), Cell{});
+        }
+        
+        void borderDraw() override {
+            const int w = _size.x;
+            const int h = _size.y;
+            lineHorizDraw({0,0}, w, 0);
+            lineHorizDraw({0,h-1}, w, 0);
+            lineVertDraw({0,0}, h, 0);
+            lineVertDraw({w-1,0}, h, 0);
+            glyphDraw({0,0}, Glyph::CornerUL);
+            glyphDraw({w-1,0}, Glyph::CornerUR);
+            glyphDraw({0,h-1}, Glyph::CornerLL);
+            glyphDraw({w-1,h-1}, Glyph::CornerLR);
+        }
+        
+        void glyphDraw(const Point& p, Glyph glyph) override {
+            _cellSet(p, _GlyphChar(glyph));
+        }
+        
+        void lineHorizDraw(const Point& p, int len, wchar_t ch) override {
+            const char32_t c = (ch ? ch : _GlyphChar(Glyph::LineHoriz));
+            for (int x=p.x; x<p.x+len && x<_size.x; x++) _cellSet({x,p.y}, c);
+        }
+        
+        void lineVertDraw(const Point& p, int len, wchar_t ch) override {
+            const char32_t c = (ch ? ch : _GlyphChar(Glyph::LineVert));
+            for (int y=p.y; y<p.y+len && y<_size.y; y++) _cellSet({p.x,y}, c);
+        }
+        
+        void textDraw(const Point& p, std::string_view txt) override {
+            if (!_contains(p)) return;
+            Point pos = p;
+            while (!txt.empty()) {
+                size_t len = 0;
+                const char32_t c = UTF8::Decode(txt, len);
+                txt.remove_prefix(len);
+                
+                if (c == '\n') {
+                    // Like ncurses, a newline clears the rest of the line
+                    for (; pos.x<_size.x; pos.x++) _cellSet(pos, ' ');
+                } else if (c>=0x20 && c!=0x7F && UTF8::CodepointWidth(c)) {
+                    // Zero-width codepoints (eg combining marks) aren't represented
+                    const int w = (int)UTF8::CodepointWidth(c);
+                    // Wide characters that don't fit at the end of the line wrap
+                    if (pos.x+w > _size.x) pos = {0, pos.y+1};
+                    if (pos.y >= _size.y) return;
+                    _cellSet(pos, c);
+                    pos.x += w;
+                }
+                
+                if (pos.x >= _size.x) pos = {0, pos.y+1};
+                if (pos.y >= _size.y) return;
+            }
+        }
+    
+    private:
+        static char32_t _GlyphChar(Glyph glyph) {
+            switch (glyph) {
+            case Glyph::LineHoriz:  return U'─';
+            case Glyph::LineVert:   return U'│';
+            case Glyph::CornerUL:   return U'┌';
+            case Glyph::CornerUR:   return U'┐';
+            case Glyph::CornerLL:   return U'└';
+            case Glyph::CornerLR:   return U'┘';
+            }
+            abort();
+        }
+        
+        bool _contains(const Point& p) const {
+            return p.x>=0 && p.y>=0 && p.x<_size.x && p.y<_size.y;
+        }
+        
+        Cell& _cell(const Point& p) {
+            return _cells[p.y*_size.x + p.x];
+        }
+        
+        // _cellSet(): sets the cell at `p` to `ch` using the current attributes, splitting
+        // any wide characters that it overwrites
+        void _cellSet(const Point& p, char32_t ch) {
+            if (!_contains(p)) return;
+            const bool wide = UTF8::CodepointWidth(ch) > 1;
+            if (wide && p.x+1>=_size.x) ch = ' ';
+            
+            // Overwriting either half of a wide character blanks the other half
+            const auto unwide = [&] (const Point& q) {
+                Cell& c = _cell(q);
+                if (!c.ch && q.x>0) _cell({q.x-1,q.y}).ch = ' ';
+                if (c.ch && q.x+1<_size.x && !_cell({q.x+1,q.y}).ch) _cell({q.x+1,q.y}).ch = ' ';
+            };
+            
+            unwide(p);
+            if (wide) unwide({p.x+1,p.y});
+            
+            _cell(p) = {ch, _attr};
+            if (wide) _cell({p.x+1,p.y}) = {0, _attr};
+        }
+        
+        void _resize(const Size& s) {
+            std::vector<Cell> cells(s.x*s.y);
+            for (int y=0; y<std::min(s.y,_size.y); y++) {
+                for (int x=0; x<std::min(s.x,_size.x); x++) {
+                    cells[y*s.x + x] = _cell({x,y});
+                }
+            }
+            _cells = std::move(cells);
+            _size = s;
+        }
+        
+        HeadlessBackend& _backend;
+        Type _type = Type::Window;
+        Point _origin;
+        Size _size;
+        std::vector<Cell> _cells;
+        attr_t _attr = 0;
+        bool _hidden = false;
+        
+        friend class HeadlessBackend;
+    };
+    
+    void _composite(const _Surface& s) {
+        for (int y=0; y<s._size.y; y++) {
+            const int sy = s._origin.y+y;
+            if (sy<0 || sy>=_size.y) continue;
+            for (int x=0; x<s._size.x; x++) {
+                const int sx = s._origin.x+x;
+                if (sx<0 || sx>=_size.x) continue;
+                _frame.cells[sy*_size.x + sx] = s._cells[y*s._size.x + x];
+            }
+        }
+    }
+    
+    Size _size;
+    _Surface* _screen = nullptr;
+    std::vector<_Surface*> _panels; // Bottom to top
+    std::deque<Event> _events;
+    std::map<ColorIdx,std::array<ColorComponent,3>> _colors;
+    std::map<ColorPairIdx,std::array<ColorIdx,2>> _pairs;
+    Frame _frame;
+    size_t _frameCount = 0;
+    size_t _beepCount = 0;
+};
+
+using HeadlessBackendPtr = std::shared_ptr<HeadlessBackend>;
+
+} // namespace UI
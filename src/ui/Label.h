@@ -1,4 +1,5 @@
 #pragma once
+#include <array>
 #include "Color.h"
 
 namespace UI {
@@ -12,53 +13,38 @@ public:
         assert(constraint.y >= 0);
         
         if (!_wrap) {
-            const int prefixWidth = (int)UTF8::Len(_prefix);
-            const int suffixWidth = (int)UTF8::Len(_suffix);
-            const int fullWidth = prefixWidth + (int)UTF8::Len(_text) + suffixWidth;
+            const int prefixWidth = (int)UTF8::Width(_prefix);
+            const int suffixWidth = (int)UTF8::Width(_suffix);
+            const int fullWidth = prefixWidth + (int)UTF8::Width(_text) + suffixWidth;
             const int width = constraint.x!=ConstraintNone ? std::min(constraint.x, fullWidth) : fullWidth;
             return {width, 1};
         }
         
-        const int width = constraint.x!=ConstraintNone ? constraint.x : (int)UTF8::Len(_text);
-        const LineWrap::Options opts = {
-            .width = (size_t)width,
-            .allowEmptyLines = _allowEmptyLines,
-        };
-        std::vector<std::string> lines = LineWrap::Wrap(opts, _text);
+        const int width = constraint.x!=ConstraintNone ? constraint.x : (int)UTF8::Width(_text);
+        const LineWrap::Buffer& lines = _wrapLines((size_t)width, SIZE_MAX);
         return { width, (int)lines.size() };
     }
     
-    void layout() override {
-        // Anytime we layout, draw() needs to recreate its lines
-        _lines.clear();
-    }
-    
     void draw() override {
-        // Re-create lines
+        // Wrap lines
         // We do this in draw() (and not layout()) because the superview may set our text in its draw(),
-        // so creating _lines in our layout() would occur before the superview set our text.
-        if (_lines.empty() && !_text.empty()) {
-            if (!_wrap) {
-                _lines = { _text };
-            } else {
-                const LineWrap::Options opts = {
-                    .width = (size_t)size().x,
-                    .height = (size_t)size().y,
-                    .allowEmptyLines = _allowEmptyLines,
-                };
-                _lines = LineWrap::Wrap(opts, _text);
-            }
-        }
+        // so creating the lines in our layout() would occur before the superview set our text.
+        // Wrapping is memoized (see _wrapLines()), so this is free unless our text or size changed.
+        // Unwrapped labels are a single line, which Wrap() returns for an unlimited width
+        static const LineWrap::Buffer NoLines;
+        const LineWrap::Buffer& lines = (_text.empty() ? NoLines :
+            (_wrap ? _wrapLines((size_t)size().x, (size_t)size().y) : _wrapLines(SIZE_MAX, SIZE_MAX)));
         
         const Size s = size();
         const std::string prefix = (!_wrap ? _prefix : "");
         const std::string suffix = (!_wrap ? _suffix : "");
-        const int prefixWidth = (int)UTF8::Len(prefix);
-        const int suffixWidth = (int)UTF8::Len(suffix);
+        const int prefixWidth = (int)UTF8::Width(prefix);
+        const int suffixWidth = (int)UTF8::Width(suffix);
         
         // Draw lines
         int offY = 0;
-        for (const std::string& l : _lines) {
+        for (size_t i=0; i<lines.size(); i++) {
+            const std::string_view l = lines[i];
 //            if (l.empty()) continue;
             if (offY >= s.y) break;
             
@@ -68,11 +54,11 @@ public:
             const std::string base = (_truncate==Truncate::Tail ? UTF8::TruncateTail(l, availBaseWidth) : UTF8::TruncateHead(l, availBaseWidth));
             // Truncate `line` to our frame width
             const std::string line = UTF8::TruncateTail(prefix+base+suffix, s.x);
-            const int lineWidth = (int)UTF8::Len(line);
+            const int lineWidth = (int)UTF8::Width(line);
             
             // Draw line
             Align align = _align;
-            if (_centerSingleLine && _lines.size()==1) {
+            if (_centerSingleLine && lines.size()==1) {
                 align = Align::Center;
             }
             
@@ -90,7 +76,11 @@ public:
     }
     
     const auto& text() const { return _text; }
-    template <typename T> bool text(const T& x) { return _set(_text, x); }
+    template <typename T> bool text(const T& x) {
+        if (!_set(_text, x)) return false;
+        _wrapCacheInvalidate();
+        return true;
+    }
     
     const auto& prefix() const { return _prefix; }
     template <typename T> bool prefix(const T& x) { return _set(_prefix, x); }
@@ -114,7 +104,11 @@ public:
     template <typename T> bool wrap(const T& x) { return _set(_wrap, x); }
     
     const auto& allowEmptyLines() const { return _allowEmptyLines; }
-    template <typename T> bool allowEmptyLines(const T& x) { return _set(_allowEmptyLines, x); }
+    template <typename T> bool allowEmptyLines(const T& x) {
+        if (!_set(_allowEmptyLines, x)) return false;
+        _wrapCacheInvalidate();
+        return true;
+    }
     
 private:
 //    template <typename X, typename Y>
@@ -137,7 +131,45 @@ private:
     bool _wrap = false;
     bool _allowEmptyLines = false;
     
-    std::vector<std::string> _lines;
+    // _WrapResult: the lines resulting from wrapping `_text` to a particular size
+    struct _WrapResult {
+        bool valid = false;
+        size_t width = 0;
+        size_t height = 0;
+        LineWrap::Buffer lines;
+    };
+    
+    // _wrapLines(): returns `_text` wrapped to the given size, reusing the previous
+    // result if `_text` hasn't changed
+    // Labels are typically wrapped to 2 different sizes -- by sizeIntrinsic() with an
+    // unlimited height, and by draw() with our actual height -- so we remember the 2
+    // most recent results.
+    const LineWrap::Buffer& _wrapLines(size_t width, size_t height) {
+        for (const _WrapResult& x : _wrapCache) {
+            if (x.valid && x.width==width && x.height==height) return x.lines;
+        }
+        
+        const LineWrap::Options opts = {
+            .width = width,
+            .height = height,
+            .allowEmptyLines = _allowEmptyLines,
+        };
+        _WrapResult& x = _wrapCache[_wrapCacheNext];
+        _wrapCacheNext = (_wrapCacheNext+1) % _wrapCache.size();
+        // Reuse the result's buffer to avoid allocating
+        x.valid = true;
+        x.width = width;
+        x.height = height;
+        LineWrap::Wrap(opts, _text, x.lines);
+        return x.lines;
+    }
+    
+    void _wrapCacheInvalidate() {
+        for (_WrapResult& x : _wrapCache) x.valid = false;
+    }
+    
+    std::array<_WrapResult,2> _wrapCache;
+    size_t _wrapCacheNext = 0;
 };
 
 using LabelPtr = std::shared_ptr<Label>;
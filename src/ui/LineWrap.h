@@ -1,6 +1,8 @@
 #pragma once
 #include <optional>
-#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
 #include "Panel.h"
 #include "Color.h"
 #include "UTF8.h"
@@ -13,79 +15,137 @@ struct Options {
     bool allowEmptyLines    = false;
 };
 
-inline std::vector<std::string> Wrap(const Options& opts, std::string_view str) {
-    using Line = std::deque<std::string>;
-    using Lines = std::deque<Line>;
-    if (opts.width == SIZE_MAX) return { std::string(str) };
+// Buffer: the result of Wrap()
+// The lines' text is stored contiguously in `text`, and `lines` contains the span of
+// each line within `text`. Reusing a Buffer across Wrap() calls reuses its storage,
+// so wrapping doesn't allocate once the Buffer has grown large enough.
+struct Buffer {
+    struct Line {
+        size_t off = 0;
+        size_t len = 0;
+    };
     
-    Lines linesInput;
-    {
-        std::istringstream stream((std::string)str);
-        std::string line;
-        while (std::getline(stream, line)) {
-            if (!opts.allowEmptyLines && line.empty()) continue;
-            
-            Line& lineInput = linesInput.emplace_back();
-            std::istringstream linestream(line);
-            std::string word;
-            while (linestream >> word) lineInput.push_back(word);
-        }
+    std::string text;
+    std::vector<Line> lines;
+    
+    size_t size() const { return lines.size(); }
+    bool empty() const { return lines.empty(); }
+    std::string_view operator[](size_t i) const { return std::string_view(text).substr(lines[i].off, lines[i].len); }
+    
+    void clear() {
+        text.clear();
+        lines.clear();
+    }
+};
+
+inline bool _Space(char c) {
+    return c==' ' || c=='\t' || c=='\n' || c=='\v' || c=='\f' || c=='\r';
+}
+
+// _Head(): returns the beginning of `str` that fits in `width` cells
+inline std::string_view _Head(std::string_view str, size_t width) {
+    return str.substr(0, UTF8::WidthPrefixLen(str, width));
+}
+
+// Wrap(): wraps `str` into lines of at most `opts.width` cells, by breaking
+// lines between words, which are separated by a single space in the result
+// Words that don't fit on a line by themselves are split across lines. Input lines
+// that are empty are skipped unless `opts.allowEmptyLines`. If `opts.height` lines
+// isn't enough to contain the text, the last line is filled with as much of the next
+// word as fits.
+//
+// `str` is scanned once; words are referenced in place rather than copied, and the
+// result is written to `buf`, replacing its contents.
+inline void Wrap(const Options& opts, std::string_view str, Buffer& buf) {
+    buf.clear();
+    if (opts.width == SIZE_MAX) {
+        buf.text = str;
+        buf.lines.push_back({0, str.size()});
+        return;
     }
+    if (!opts.width) return;
+    
+    // Width of the current line, in cells
+    size_t lineLen = 0;
     
-    std::vector<std::string> lines;
-    Line* lastLine = nullptr;
-    while (lines.size()<opts.height && !linesInput.empty()) {
-        Line& lineInput = linesInput.front();
-        std::string& msgline = lines.emplace_back();
+    const auto lineCreate = [&] () {
+        if (buf.lines.size() >= opts.height) return false;
+        buf.lines.push_back({buf.text.size(), 0});
+        lineLen = 0;
+        return true;
+    };
+    
+    const auto lineAppend = [&] (std::string_view x) {
+        buf.text += x;
+        buf.lines.back().len += x.size();
+        lineLen += UTF8::Width(x);
+    };
+    
+    while (!str.empty()) {
+        // Pop the next input line off `str`
+        const size_t lineEnd = str.find('\n');
+        std::string_view input = str.substr(0, lineEnd);
+        str = (lineEnd!=std::string_view::npos ? str.substr(lineEnd+1) : std::string_view());
+        if (!opts.allowEmptyLines && input.empty()) continue;
+        
+        if (!lineCreate()) return;
         
-        while (!lineInput.empty()) {
-            // Add the current word
-            const std::string& word = lineInput.front();
-            const size_t wordLen = UTF8::Len(word);
-            const std::string add = (msgline.empty() ? "" : " ") + word;
-            const size_t addLen = UTF8::Len(add);
-            const size_t rem = opts.width-UTF8::Len(msgline);
-            // No more space -> next line
-            if (!rem) break;
-            // Check if the line would overflow with `add`
-            if (addLen > rem) {
-                // The word (without potential space) would fit by itself on a line -> next line
-                if (wordLen <= opts.width) break;
+        for (;;) {
+            // Pop the next word off `input`
+            size_t wordStart = 0;
+            while (wordStart<input.size() && _Space(input[wordStart])) wordStart++;
+            if (wordStart == input.size()) break;
+            size_t wordEnd = wordStart;
+            while (wordEnd<input.size() && !_Space(input[wordEnd])) wordEnd++;
+            std::string_view word = input.substr(wordStart, wordEnd-wordStart);
+            input = input.substr(wordEnd);
+            
+            for (;;) {
+                const size_t wordLen = UTF8::Width(word);
+                const std::string_view sep = (lineLen ? " " : "");
+                const size_t addLen = sep.size() + wordLen;
+                // A wide codepoint can overflow an otherwise-empty line, leaving no space
+                const size_t rem = (lineLen<opts.width ? opts.width-lineLen : 0);
+                
+                // The word fits on the current line
+                if (rem && addLen<=rem) {
+                    lineAppend(sep);
+                    lineAppend(word);
+                    break;
+                }
+                
                 // The word wouldn't fit by itself on a line -> split word
-                std::string head = add.substr(0, rem);
-                std::string tail = add.substr(rem, addLen-rem);
+                if (rem && wordLen>opts.width) {
+                    std::string_view head = _Head(word, rem-sep.size());
+                    // If not even the first codepoint fits (because it's wide), continue on the
+                    // next line, unless this line is empty, in which case the codepoint has to
+                    // overflow it to guarantee progress
+                    if (head.empty() && !lineLen) {
+                        size_t len = 0;
+                        UTF8::Decode(word, len);
+                        head = word.substr(0, len);
+                    }
+                    
+                    if (!head.empty()) {
+                        lineAppend(sep);
+                        lineAppend(head);
+                        word = word.substr(head.size());
+                        continue;
+                    }
+                }
                 
-                msgline += head;
-                lineInput.pop_front();
-                lineInput.push_front(tail);
-                continue;
+                // No more space -> next line
+                if (!lineCreate()) {
+                    // We're out of lines, so add as many letters from the word as will fit on the last line
+                    if (rem) {
+                        lineAppend(sep);
+                        lineAppend(_Head(word, rem-sep.size()));
+                    }
+                    return;
+                }
             }
-            
-            msgline += add;
-            lineInput.pop_front();
-        }
-        
-        if (lineInput.empty()) {
-            linesInput.pop_front();
-            lastLine = nullptr;
-        } else {
-            lastLine = &linesInput.front();
         }
     }
-    
-    // Add as many letters from the remaining word as will fit on the last line
-    if (lastLine && !lastLine->empty()) {
-        const std::string& word = lastLine->front();
-        std::string& line = lines.back();
-        line += (line.empty() ? "" : " ") + word;
-        // Our logic guarantees that if the word would have fit, it would've been included in the last line.
-        // So since the word isn't included, the length of the line (with the word included) must be larger
-        // than `width`. So verify that assumption.
-        assert(UTF8::Len(line) > opts.width);
-        line.erase(opts.width);
-    }
-    
-    return lines;
 }
 
 } // namespace UI::LineWrap
@@ -0,0 +1,311 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include "UI.h"
+#include "UTF8.h"
+#include "lib/toastbox/RuntimeError.h"
+
+namespace UI {
+
+// LowBandwidthRenderer: writes frames to the terminal by diffing the ncurses virtual
+// screen (as composited by update_panels()) against its own copy of the terminal's
+// cells, instead of relying on doupdate()
+// Only the cells that changed are written, cursor movement is skipped when rewriting
+// the cells in between is cheaper, and attributes are only sent when they change.
+// Each frame is wrapped in synchronized-output markers (DEC mode 2026), so that
+// terminals that support them present the frame atomically.
+class LowBandwidthRenderer {
+public:
+    // Stats: the amount of output that render() has produced, for measuring how much
+    // bandwidth is saved (see LowBandwidthCheck)
+    struct Stats {
+        size_t frameCount = 0;
+        size_t frameBytes = 0; // Bytes written by the most recent frame
+        size_t totalBytes = 0;
+    };
+    
+    // Frames are written to `fd`, which is normally the terminal that ncurses is using
+    LowBandwidthRenderer(int fd=STDOUT_FILENO) : _fd(fd) {}
+    
+    // synced(): returns whether our copy of the terminal's cells matches the dimensions
+    // of `scr`, and therefore whether render() can be used
+    bool synced(WINDOW* scr) const {
+        return _size == Size{getmaxx(scr), getmaxy(scr)};
+    }
+    
+    // sync(): adopts the contents of `scr` as the terminal's contents, after they were
+    // written to the terminal by other means (ie doupdate())
+    void sync(WINDOW* scr, const CursorState& cursor) {
+        _size = {getmaxx(scr), getmaxy(scr)};
+        _cells.resize(_size.x*_size.y);
+        for (int y=0; y<_size.y; y++) {
+            for (int x=0; x<_size.x;) {
+                x += _cellsRead(scr, {x,y});
+            }
+        }
+        
+        // The terminal's cursor position and attributes are unknown
+        _term = {};
+        _term.cursorVisible = cursor.visible;
+    }
+    
+    // invalidate(): discards our copy of the terminal's cells, so that the next frame
+    // is written by other means, followed by sync()
+    void invalidate() {
+        _size = {};
+    }
+    
+    // render(): writes the cells of `scr` that changed since the last frame, and
+    // updates the cursor
+    void render(WINDOW* scr, const CursorState& cursor) {
+        assert(synced(scr));
+        _buf.clear();
+        
+        for (int y=0; y<_size.y; y++) {
+            if (!is_linetouched(scr, y)) continue;
+            for (int x=0; x<_size.x;) {
+                const _Cell cell = _CellRead(scr, {x,y});
+                _Cell& cur = _cell({x,y});
+                if (cell != cur) {
+                    _cursorMove({x,y});
+                    _attrSet(cell);
+                    _cellWrite(cell);
+                    cur = cell;
+                    // Our copy of the cell that's covered by a wide character must not match
+                    // anything, so that it's rewritten if the wide character is replaced
+                    if (cell.width>1 && x+1<_size.x) _cell({x+1,y}) = _Cell{.width=0};
+                }
+                x += cell.width;
+            }
+        }
+        
+        // Nothing reads the touched state of `scr` but us, so reset it for the next frame
+        ::untouchwin(scr);
+        
+        // Update the cursor
+        if (cursor.visible) _cursorMove(cursor.origin);
+        if (cursor.visible != _term.cursorVisible) {
+            _out(cursor.visible ? "\x1b[?25h" : "\x1b[?25l");
+            _term.cursorVisible = cursor.visible;
+        }
+        
+        if (_buf.empty()) return;
+        _buf += _SyncEnd;
+        _write(_buf);
+        
+        _stats.frameCount++;
+        _stats.frameBytes = _buf.size();
+        _stats.totalBytes += _buf.size();
+    }
+    
+    const Stats& stats() const { return _stats; }
+    
+private:
+    static constexpr const char* _SyncBegin = "\x1b[?2026h";
+    static constexpr const char* _SyncEnd   = "\x1b[?2026l";
+    
+    struct _Cell {
+        std::array<wchar_t,CCHARW_MAX> chars = {};
+        attr_t attr = 0;
+        short pair = 0;
+        uint8_t width = 1;
+        
+        bool operator ==(const _Cell& x) const {
+            return chars==x.chars && attr==x.attr && pair==x.pair && width==x.width;
+        }
+        bool operator !=(const _Cell& x) const { return !(*this == x); }
+        
+        bool ascii() const { return chars[0]<0x80 && !chars[1]; }
+    };
+    
+    // _AcsChar(): returns the unicode equivalent of the A_ALTCHARSET character `c`
+    static wchar_t _AcsChar(wchar_t c) {
+        switch (c) {
+        case 'q':   return L'─';
+        case 'x':   return L'│';
+        case 'l':   return L'┌';
+        case 'k':   return L'┐';
+        case 'm':   return L'└';
+        case 'j':   return L'┘';
+        case 't':   return L'├';
+        case 'u':   return L'┤';
+        case 'w':   return L'┬';
+        case 'v':   return L'┴';
+        case 'n':   return L'┼';
+        case 'a':   return L'▒';
+        case '~':   return L'·';
+        default:    return c;
+        }
+    }
+    
+    static _Cell _CellRead(WINDOW* scr, const Point& p) {
+        cchar_t cc = {};
+        mvwin_wch(scr, p.y, p.x, &cc);
+        
+        wchar_t chars[CCHARW_MAX+1] = {};
+        attr_t attr = 0;
+        short pair = 0;
+        ::getcchar(&cc, chars, &attr, &pair, nullptr);
+        
+        _Cell cell;
+        for (size_t i=0; i<CCHARW_MAX && chars[i]; i++) cell.chars[i] = chars[i];
+        if (!cell.chars[0]) cell.chars[0] = ' ';
+        if (attr & A_ALTCHARSET) cell.chars[0] = _AcsChar(cell.chars[0]);
+        cell.attr = attr & (A_ATTRIBUTES & ~(A_COLOR|A_ALTCHARSET));
+        cell.pair = pair;
+        cell.width = (UTF8::CodepointWidth(cell.chars[0])>1 ? 2 : 1);
+        // A wide character can't start in the last column, but ncurses can leave the second
+        // half of one there (eg when a panel covers the first half). Writing it would make
+        // the terminal wrap, so write a space instead.
+        if (cell.width>1 && p.x+1>=getmaxx(scr)) {
+            cell.chars = {' '};
+            cell.width = 1;
+        }
+        return cell;
+    }
+    
+    _Cell& _cell(const Point& p) {
+        return _cells[p.y*_size.x + p.x];
+    }
+    
+    // _cellsRead(): reads the cell at `p` into our copy of the terminal's cells,
+    // returning the number of columns it occupies
+    int _cellsRead(WINDOW* scr, const Point& p) {
+        const _Cell cell = _CellRead(scr, p);
+        _cell(p) = cell;
+        if (cell.width>1 && p.x+1<_size.x) _cell({p.x+1,p.y}) = _Cell{.width=0};
+        return cell.width;
+    }
+    
+    void _out(std::string_view x) {
+        if (_buf.empty()) _buf += _SyncBegin;
+        _buf += x;
+    }
+    
+    // _cursorMove(): moves the terminal's cursor to `p`, using whichever of
+    // absolute/relative positioning, or rewriting the cells in between, is shortest
+    void _cursorMove(const Point& p) {
+        if (_term.posValid && _term.pos==p) return;
+        
+        char cup[32];
+        const int cupLen = snprintf(cup, sizeof(cup), "\x1b[%d;%dH", p.y+1, p.x+1);
+        
+        if (_term.posValid && _term.pos.y==p.y && _term.pos.x<p.x) {
+            const int gap = p.x-_term.pos.x;
+            char cuf[32];
+            const int cufLen = snprintf(cuf, sizeof(cuf), "\x1b[%dC", gap);
+            
+            // Rewrite the cells in between if that's cheaper than moving the cursor, which
+            // requires that they're single-byte and use the current attributes
+            if (gap < std::min(cupLen, cufLen)) {
+                bool rewrite = true;
+                for (int x=_term.pos.x; x<p.x && rewrite; x++) {
+                    const _Cell& c = _cell({x,p.y});
+                    rewrite = c.ascii() && c.width==1 && _term.attrValid && c.attr==_term.attr && c.pair==_term.pair;
+                }
+                
+                if (rewrite) {
+                    for (int x=_term.pos.x; x<p.x; x++) _cellWrite(_cell({x,p.y}));
+                    return;
+                }
+            }
+            
+            // Move forward relative to the current position
+            if (cufLen < cupLen) {
+                _out(cuf);
+                _term.pos = p;
+                return;
+            }
+        }
+        
+        _out(cup);
+        _term.pos = p;
+        _term.posValid = true;
+    }
+    
+    // _attrSet(): sets the terminal's attributes to those of `cell`, if they differ
+    void _attrSet(const _Cell& cell) {
+        if (_term.attrValid && cell.attr==_term.attr && cell.pair==_term.pair) return;
+        
+        std::string sgr = "\x1b[0";
+        if (cell.attr & A_BOLD)                     sgr += ";1";
+        if (cell.attr & A_DIM)                      sgr += ";2";
+        if (cell.attr & A_ITALIC)                   sgr += ";3";
+        if (cell.attr & A_UNDERLINE)                sgr += ";4";
+        if (cell.attr & A_BLINK)                    sgr += ";5";
+        if (cell.attr & (A_REVERSE|A_STANDOUT))     sgr += ";7";
+        if (cell.attr & A_INVIS)                    sgr += ";8";
+        
+        if (cell.pair) {
+            NCURSES_COLOR_T fg = -1;
+            NCURSES_COLOR_T bg = -1;
+            ::pair_content(cell.pair, &fg, &bg);
+            _ColorAppend(sgr, fg, 30);
+            _ColorAppend(sgr, bg, 40);
+        }
+        
+        sgr += "m";
+        _out(sgr);
+        
+        _term.attr = cell.attr;
+        _term.pair = cell.pair;
+        _term.attrValid = true;
+    }
+    
+    // _ColorAppend(): appends the SGR parameter for color `c` to `sgr`, where `base`
+    // is 30 for the foreground color or 40 for the background color
+    static void _ColorAppend(std::string& sgr, NCURSES_COLOR_T c, int base) {
+        if (c < 0) return; // Default color, which SGR 0 already selected
+        if (c < 8) sgr += ";" + std::to_string(base+c);
+        else if (c < 16) sgr += ";" + std::to_string(base+60+c-8);
+        else sgr += ";" + std::to_string(base+8) + ";5;" + std::to_string(c);
+    }
+    
+    void _cellWrite(const _Cell& cell) {
+        if (_buf.empty()) _buf += _SyncBegin;
+        
+        for (wchar_t c : cell.chars) {
+            if (!c) break;
+            UTF8::Encode(c, _buf);
+        }
+        
+        _term.pos.x += cell.width;
+        // The terminal's cursor position is unknown after writing to the last column,
+        // because terminals differ in whether they wrap immediately
+        if (_term.pos.x >= _size.x) _term.posValid = false;
+    }
+    
+    void _write(std::string_view x) {
+        while (!x.empty()) {
+            const ssize_t sr = ::write(_fd, x.data(), x.size());
+            if (sr < 0) {
+                if (errno == EINTR) continue;
+                throw Toastbox::RuntimeError("write failed: %s", strerror(errno));
+            }
+            x.remove_prefix(sr);
+        }
+    }
+    
+    int _fd = -1;
+    Size _size;
+    std::vector<_Cell> _cells;
+    std::string _buf;
+    Stats _stats;
+    
+    // State of the terminal, as of the end of the last frame
+    struct {
+        Point pos;
+        bool posValid = false;
+        bool cursorVisible = false;
+        attr_t attr = 0;
+        short pair = 0;
+        bool attrValid = false;
+    } _term;
+};
+
+} // namespace UI
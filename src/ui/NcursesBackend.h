@@ -0,0 +1,236 @@
+#pragma once
+#include <optional>
+#include <cstdlib>
+#include <cassert>
+#include "RenderBackend.h"
+#include "LowBandwidthRenderer.h"
+#include "xterm-256color.h"
+
+namespace UI {
+
+// NcursesBackend: renders to the terminal via ncurses, using ncurses panels to
+// composite Panel surfaces
+class NcursesBackend : public RenderBackend {
+public:
+    void init() override {
+        // Default Linux installs may not contain the /usr/share/terminfo database,
+        // so provide a fallback terminfo that usually works.
+        nc_set_default_terminfo(xterm_256color, sizeof(xterm_256color));
+        
+        // Override the terminfo 'kmous' and 'XM' properties to permit mouse-moved events,
+        // in addition to the default mouse-down/up events.
+        //   kmous = the prefix used to detect/parse mouse events
+        //   XM    = the escape string used to enable mouse events (1006=SGR 1006 mouse
+        //           event mode; 1003=report mouse-moved events in addition to clicks)
+        setenv("TERM_KMOUS", "\x1b[<", true);
+        setenv("TERM_XM", "\x1b[?1006;1003%?%p1%{1}%=%th%el%;", true);
+        
+        ::initscr();
+        ::noecho();
+        ::raw();
+        
+        ::use_default_colors();
+        ::start_color();
+        
+        // Hide cursor
+        ::curs_set(0);
+        
+        ::mousemask(ALL_MOUSE_EVENTS | REPORT_MOUSE_POSITION, NULL);
+        ::mouseinterval(0);
+        
+        ::set_escdelay(0);
+        
+        // The terminal's contents are unknown after (re)initialization, so restart the
+        // low-bandwidth renderer from the next full frame
+        if (lowBandwidth()) lowBandwidth(true);
+    }
+    
+    void deinit() override {
+        ::endwin();
+    }
+    
+    SurfacePtr surfaceScreen() override {
+        return std::make_unique<_Surface>(::stdscr, nullptr, false);
+    }
+    
+    SurfacePtr surfaceCreate(Surface::Type type) override {
+        WINDOW* win = ::newwin(0, 0, 0, 0);
+        assert(win);
+        PANEL* panel = nullptr;
+        if (type == Surface::Type::Panel) {
+            panel = ::new_panel(win);
+            assert(panel);
+        }
+        return std::make_unique<_Surface>(win, panel, true);
+    }
+    
+    void present(const CursorState& cursor) override {
+        ::update_panels();
+        
+        if (_lowBandwidthRenderer && _lowBandwidthRenderer->synced(newscr)) {
+            ::wnoutrefresh(stdscr);
+            _lowBandwidthRenderer->render(newscr, cursor);
+        
+        } else {
+            ::refresh();
+            ::curs_set(cursor.visible);
+            ::move(cursor.origin.y, cursor.origin.x);
+            // ncurses wrote this frame in its entirety (because it's the first frame, or the
+            // terminal was resized), so it's the starting point for the low-bandwidth renderer
+            if (_lowBandwidthRenderer) _lowBandwidthRenderer->sync(newscr, cursor);
+        }
+    }
+    
+    Event eventRead(int timeoutMs) override {
+        ::wtimeout(stdscr, timeoutMs);
+        const int ch = ::wgetch(stdscr);
+        if (ch == ERR) return {};
+        
+        Event ev = { .type = (Event::Type)ch };
+        if (ev.type == Event::Type::Mouse) {
+            MEVENT mouse = {};
+            const int ir = ::getmouse(&mouse);
+            if (ir != OK) return {};
+            ev.mouse = {
+                .origin = {mouse.x, mouse.y},
+                .bstate = mouse.bstate,
+            };
+        }
+        return ev;
+    }
+    
+    void beep() override {
+        ::beep();
+    }
+    
+    bool colorsChangeable() const override {
+        return ::can_change_color();
+    }
+    
+    bool colorGet(ColorIdx idx, ColorComponent& r, ColorComponent& g, ColorComponent& b) override {
+        return ::color_content(idx, &r, &g, &b) == OK;
+    }
+    
+    bool colorSet(ColorIdx idx, ColorComponent r, ColorComponent g, ColorComponent b) override {
+        return ::init_color(idx, r, g, b) == OK;
+    }
+    
+    bool pairGet(ColorPairIdx idx, ColorIdx& fg, ColorIdx& bg) override {
+        return ::pair_content(idx, &fg, &bg) == OK;
+    }
+    
+    bool pairSet(ColorPairIdx idx, ColorIdx fg, ColorIdx bg) override {
+        return ::init_pair(idx, fg, bg) == OK;
+    }
+    
+    // lowBandwidth(): whether frames are written by LowBandwidthRenderer instead of ncurses,
+    // to minimize bandwidth for remote terminals
+    // Enabling the renderer when it's already enabled restarts it, which is necessary
+    // when the terminal's contents are lost (eg after running a text editor).
+    bool lowBandwidth() const { return (bool)_lowBandwidthRenderer; }
+    void lowBandwidth(bool x) {
+        if (x) _lowBandwidthRenderer.emplace();
+        else _lowBandwidthRenderer = std::nullopt;
+    }
+    
+private:
+    class _Surface : public Surface {
+    public:
+        _Surface(WINDOW* win, PANEL* panel, bool owned) : _win(win), _panel(panel), _owned(owned) {
+            ::keypad(_win, true);
+            ::meta(_win, true);
+        }
+        
+        ~_Surface() {
+            if (_panel) ::del_panel(_panel);
+            if (_owned) ::delwin(_win);
+        }
+        
+        Point origin() const override { return { getbegx(_win), getbegy(_win) }; }
+        bool origin(const Point& p) override {
+            if (_panel) return ::move_panel(_panel, p.y, p.x) == OK;
+            return ::mvwin(_win, p.y, p.x) == OK;
+        }
+        
+        Size size() const override { return { getmaxx(_win), getmaxy(_win) }; }
+        bool size(const Size& s) override {
+            return ::wresize(_win, s.y, s.x) == OK;
+        }
+        
+        bool visible() const override {
+            return !_panel || !::panel_hidden(_panel);
+        }
+        
+        void visible(bool x) override {
+            assert(_panel);
+            if (x) ::show_panel(_panel);
+            else ::hide_panel(_panel);
+        }
+        
+        void orderFront() override {
+            if (_panel) ::top_panel(_panel);
+        }
+        
+        void attrOn(attr_t attr) override { ::wattr_on(_win, attr, nullptr); }
+        void attrOff(attr_t attr) override { ::wattr_off(_win, attr, nullptr); }
+        
+        void erase() override { ::werase(_win); }
+        void borderDraw() override { ::box(_win, 0, 0); }
+        
+        void glyphDraw(const Point& p, Glyph glyph) override {
+            mvwaddch(_win, p.y, p.x, _AcsChar(glyph));
+        }
+        
+        void lineHorizDraw(const Point& p, int len, wchar_t ch) override {
+            if (ch < 0x80) {
+                mvwhline(_win, p.y, p.x, (chtype)ch, len);
+            } else {
+                const cchar_t cc = _CChar(ch);
+                mvwhline_set(_win, p.y, p.x, &cc, len);
+            }
+        }
+        
+        void lineVertDraw(const Point& p, int len, wchar_t ch) override {
+            if (ch < 0x80) {
+                mvwvline(_win, p.y, p.x, (chtype)ch, len);
+            } else {
+                const cchar_t cc = _CChar(ch);
+                mvwvline_set(_win, p.y, p.x, &cc, len);
+            }
+        }
+        
+        void textDraw(const Point& p, std::string_view txt) override {
+            mvwaddnstr(_win, p.y, p.x, txt.data(), (int)txt.size());
+        }
+    
+    private:
+        static chtype _AcsChar(Glyph glyph) {
+            switch (glyph) {
+            case Glyph::LineHoriz:  return ACS_HLINE;
+            case Glyph::LineVert:   return ACS_VLINE;
+            case Glyph::CornerUL:   return ACS_ULCORNER;
+            case Glyph::CornerUR:   return ACS_URCORNER;
+            case Glyph::CornerLL:   return ACS_LLCORNER;
+            case Glyph::CornerLR:   return ACS_LRCORNER;
+            }
+            abort();
+        }
+        
+        static cchar_t _CChar(wchar_t ch) {
+            const wchar_t chars[] = { ch, 0 };
+            cchar_t cc = {};
+            ::setcchar(&cc, chars, 0, 0, nullptr);
+            return cc;
+        }
+        
+        WINDOW* _win = nullptr;
+        PANEL* _panel = nullptr;
+        bool _owned = false;
+    };
+    
+    std::optional<LowBandwidthRenderer> _lowBandwidthRenderer;
+};
+
+using NcursesBackendPtr = std::shared_ptr<NcursesBackend>;
+
+} // namespace UI
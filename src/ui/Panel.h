@@ -5,32 +5,18 @@ namespace UI {
 
 class Panel : public Window {
 public:
-    Panel() {
-        _panel = ::new_panel(*this);
-        assert(_panel);
+    Panel() : Window(View::Backend().surfaceCreate(RenderBackend::Surface::Type::Panel)) {
 //        // Give ourself an initial size (otherwise origin()
 //        // doesn't work until the size is set)
 //        size({1,1});
     }
     
-    ~Panel() {
-        ::del_panel(_panel);
-        _panel = nullptr;
-    }
-    
-    Point windowOrigin() const override { return Window::windowOrigin(); }
-    bool windowOrigin(const Point& p) override {
-        if (p == windowOrigin()) return false;
-        ::move_panel(*this, p.y, p.x);
-        return true;
-    }
-    
     using Window::layout;
     void layout(GraphicsState gstate) override {
         if (!visible()) return;
         
         // If panels need to be ordered during this layout pass, do so now
-        if (gstate.orderPanels) ::top_panel(*this);
+        if (gstate.orderPanels) surface().orderFront();
         
         Window::layout(gstate);
     }
@@ -41,18 +27,13 @@ public:
 //    }
     
     bool visible() const override {
-        return !::panel_hidden(*this);
+        return surface().visible();
     }
     
     bool visible(bool v) override {
         if (visible() == v) return false;
-        if (v) {
-            ::show_panel(*this);
-            screen().orderPanelsNeeded(true);
-        
-        } else {
-            ::hide_panel(*this);
-        }
+        surface().visible(v);
+        if (v) screen().orderPanelsNeeded(true);
         return true;
     }
     
@@ -69,14 +50,11 @@ public:
 //        ::bottom_panel(*this);
 //    }
     
-    operator PANEL*() const { return _panel; }
-    
 private:
 //    void _orderFront() {
 //        ::top_panel(*this);
 //    }
     
-    PANEL* _panel = nullptr;
     Point _pos;
 };
 
@@ -0,0 +1,103 @@
+#pragma once
+#include <memory>
+#include <string_view>
+#include "UI.h"
+
+namespace UI {
+
+using ColorIdx       = NCURSES_COLOR_T;
+using ColorPairIdx   = NCURSES_PAIRS_T;
+// ColorComponent: a single r/g/b component of a color, in the range [0,1000]
+using ColorComponent = NCURSES_COLOR_T;
+
+// Glyph: line-drawing characters, which each backend renders in its own way
+enum class Glyph : uint8_t {
+    LineHoriz,
+    LineVert,
+    CornerUL,
+    CornerUR,
+    CornerLL,
+    CornerLR,
+};
+
+// RenderBackend: the interface through which the UI draws, presents frames and reads
+// input, so that it can target either a terminal (NcursesBackend) or an in-memory
+// cell grid (HeadlessBackend)
+class RenderBackend {
+public:
+    // Surface: a grid of cells that a Window draws into
+    // Panel surfaces are composited on top of the screen surface in z-order when a frame
+    // is presented.
+    class Surface {
+    public:
+        enum class Type : uint8_t {
+            Window,
+            Panel,
+        };
+        
+        virtual ~Surface() = default;
+        
+        // MARK: - Geometry
+        // origin()/size() setters return false if the backend refused the change, which
+        // happens when the surface would extend beyond the screen
+        virtual Point origin() const = 0;
+        virtual bool origin(const Point& p) = 0;
+        virtual Size size() const = 0;
+        virtual bool size(const Size& s) = 0;
+        
+        // MARK: - Panels
+        virtual bool visible() const = 0;
+        virtual void visible(bool x) = 0;
+        virtual void orderFront() = 0;
+        
+        // MARK: - Drawing
+        // Coordinates are relative to the surface. Drawing uses the attributes enabled
+        // via attrOn(), and is clipped to the surface.
+        virtual void attrOn(attr_t attr) = 0;
+        virtual void attrOff(attr_t attr) = 0;
+        virtual void erase() = 0;
+        virtual void borderDraw() = 0;
+        virtual void glyphDraw(const Point& p, Glyph glyph) = 0;
+        // lineHorizDraw()/lineVertDraw(): draws `len` copies of `ch`, or a line if `ch`==0
+        virtual void lineHorizDraw(const Point& p, int len, wchar_t ch=0) = 0;
+        virtual void lineVertDraw(const Point& p, int len, wchar_t ch=0) = 0;
+        // textDraw(): draws the UTF-8 string `txt`, wrapping at the right edge
+        virtual void textDraw(const Point& p, std::string_view txt) = 0;
+    };
+    
+    using SurfacePtr = std::unique_ptr<Surface>;
+    
+    virtual ~RenderBackend() = default;
+    
+    // init()/deinit(): acquires/releases the display and input devices
+    // deinit() is also used to temporarily hand the terminal to another program (eg a
+    // text editor), after which init() is called again.
+    virtual void init() = 0;
+    virtual void deinit() = 0;
+    
+    // surfaceScreen(): returns a surface that covers the entire screen, below all panels
+    virtual SurfacePtr surfaceScreen() = 0;
+    // surfaceCreate(): returns a new surface, which initially covers the entire screen
+    virtual SurfacePtr surfaceCreate(Surface::Type type) = 0;
+    
+    // present(): composites the surfaces and displays the result
+    virtual void present(const CursorState& cursor) = 0;
+    
+    // eventRead(): returns the next input event, or an empty event if none arrives
+    // within `timeoutMs` (-1: wait indefinitely)
+    virtual Event eventRead(int timeoutMs) = 0;
+    
+    virtual void beep() = 0;
+    
+    // MARK: - Colors
+    // The getters/setters return false on failure
+    virtual bool colorsChangeable() const = 0;
+    virtual bool colorGet(ColorIdx idx, ColorComponent& r, ColorComponent& g, ColorComponent& b) = 0;
+    virtual bool colorSet(ColorIdx idx, ColorComponent r, ColorComponent g, ColorComponent b) = 0;
+    virtual bool pairGet(ColorPairIdx idx, ColorIdx& fg, ColorIdx& bg) = 0;
+    virtual bool pairSet(ColorPairIdx idx, ColorIdx fg, ColorIdx bg) = 0;
+};
+
+using RenderBackendPtr = std::shared_ptr<RenderBackend>;
+
+} // namespace UI
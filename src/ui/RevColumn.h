@@ -1,5 +1,7 @@
 #pragma once
 #include "git/Git.h"
+#include "git/Ancestry.h"
+#include "git/CommitInfo.h"
 #include "Panel.h"
 #include "CommitPanel.h"
 #include "Color.h"
@@ -76,42 +78,59 @@ public:
 //        _redoButton->visible(false);
 //        _snapshotsButton->visible(false);
         
-        // Create our CommitPanels for each commit
-        Git::Commit commit = _rev.commit;
-        size_t skip = _rev.skip;
-        size_t i = 0;
+        // Create our CommitPanels for the visible commits, starting `_scroll` commits
+        // past `_rev.displayHead()`
+        // Only the commits that are visible get loaded from the repository, into the
+        // shared CommitInfoArena, and panels for commits that were already visible
+        // are reused.
+        Git::Ancestry& ancestry = Git::Ancestry::ForRepo(_repo);
+        Git::CommitInfoArena& infos = Git::CommitInfoArena::ForRepo(_repo);
+        // The history may have gotten shorter since we were scrolled
+        _scroll = _scrollClamp(_scroll);
+        CommitPanelVec panels;
         int offY = _CommitsInsetY;
-        while (commit) {
-            if (!skip) {
-                CommitPanelPtr panel = (i<_panels.size() ? _panels[i] : nullptr);
-                
-                // Create the panel if it doesn't already exist, or if it does but contains the wrong commit
-                if (!panel || panel->commit()!=commit) {
-                    panel = subviewCreate<CommitPanel>();
-                    panel->commit(commit);
-                    _panels.insert(_panels.begin()+i, panel);
+        for (size_t i=_rev.skip+_scroll;; i++) {
+            const Git::Ancestry::Pos pos = _chainPos(i);
+            if (pos == Git::Ancestry::PosNull) break;
+            
+            const Git::Id id = ancestry.id(pos);
+            CommitPanelPtr panel;
+            for (CommitPanelPtr p : _panels) {
+                if (git_oid_equal(&p->commit().id, &id)) {
+                    panel = p;
+                    break;
                 }
-                
-                const Size panelSize = panel->sizeIntrinsic({size.x, ConstraintNone});
-                const int rem = size.y-offY;
-                if (panelSize.y > rem) break;
-                
-                offY += panelSize.y + _CommitSpacing;
-                i++;
+            }
             
-            } else {
-                skip--;
+            // Create the panel if we don't already have one for the commit
+            if (!panel) {
+                panel = subviewCreate<CommitPanel>();
+                panel->commit(infos.info(id));
             }
             
-            commit = commit.parent();
+            const Size panelSize = panel->sizeIntrinsic({size.x, ConstraintNone});
+            const int rem = size.y-offY;
+            if (panelSize.y > rem) break;
+            
+            offY += panelSize.y + _CommitSpacing;
+            panels.push_back(panel);
         }
         
-        // Erase excess panels (ones that extend beyond visible region)
-        _panels.erase(_panels.begin()+i, _panels.end());
+        // Panels that are no longer visible are destroyed here
+        _panels = panels;
         
         layoutNeeded(true);
     }
     
+    // scrollBy(): scrolls the column by `delta` commits, without scrolling past the
+    // top of the column or the root commit
+    // Returns whether the scroll offset changed; reload() must be called to update
+    // the panels.
+    bool scrollBy(ssize_t delta) {
+        const size_t x = (delta<0 ? _scroll-std::min(_scroll, (size_t)-delta) : _scroll+delta);
+        return _set(_scroll, _scrollClamp(x));
+    }
+    
     void layout() override {
         constexpr int UndoWidth      = 8;
         constexpr int RedoWidth      = 8;
@@ -204,6 +223,9 @@ public:
     const auto& rev() const { return _rev; }
     template <typename T> bool rev(const T& x) { return _set(_rev, x); }
     
+    const auto& scrollOffset() const { return _scroll; }
+    template <typename T> bool scrollOffset(const T& x) { return _set(_scroll, x); }
+    
     const auto& head() const { return _head; }
     template <typename T> bool head(const T& x) { return _set(_head, x); }
     
@@ -229,6 +251,35 @@ private:
     static constexpr int _CommitsInsetY         = 5;
     static constexpr int _CommitSpacing         = 1;
     
+    // _chainPos(): returns the ancestry position of the `i`th first-parent ancestor of
+    // `_rev.commit`, or PosNull if the history ends first
+    // Positions are remembered in `_chain` as it's walked, so that scrolling to any
+    // previously-reached offset doesn't need to walk the history again.
+    Git::Ancestry::Pos _chainPos(size_t i) {
+        Git::Ancestry& ancestry = Git::Ancestry::ForRepo(_repo);
+        const Git::Id head = (_rev.commit ? _rev.commit.id() : Git::Id{});
+        if (!git_oid_equal(&_chain.head, &head)) {
+            _chain = { .head = head };
+            const Git::Ancestry::Pos pos = ancestry.pos(_rev.commit);
+            if (pos != Git::Ancestry::PosNull) _chain.positions.push_back(pos);
+            else                               _chain.end = true;
+        }
+        
+        while (i>=_chain.positions.size() && !_chain.end) {
+            const Git::Ancestry::Pos pos = ancestry.parent(_chain.positions.back());
+            if (pos != Git::Ancestry::PosNull) _chain.positions.push_back(pos);
+            else                               _chain.end = true;
+        }
+        return (i<_chain.positions.size() ? _chain.positions[i] : Git::Ancestry::PosNull);
+    }
+    
+    // _scrollClamp(): returns the nearest scroll offset to `x` that shows at least one commit
+    size_t _scrollClamp(size_t x) {
+        if (_chainPos(_rev.skip+x) != Git::Ancestry::PosNull) return x;
+        const size_t len = _chain.positions.size();
+        return (len>_rev.skip ? len-1-_rev.skip : 0);
+    }
+    
     static const char* _ReadOnlyReason(Rev::Mutability mutability) {
         switch (mutability) {
         case Rev::Mutability::Allowed:                      return nullptr;
@@ -254,6 +305,15 @@ private:
     Rev _rev;
     bool _head = false;
     CommitPanelVec _panels;
+    // Number of commits scrolled past the top of the column
+    size_t _scroll = 0;
+    
+    struct {
+        Git::Id head = {};
+        std::vector<Git::Ancestry::Pos> positions;
+        // Whether `positions` ends with a root commit
+        bool end = false;
+    } _chain;
     
     TextFieldPtr _nameField     = subviewCreate<TextField>();
     LabelPtr _statusLine1       = subviewCreate<Label>();
@@ -1,20 +1,29 @@
 #pragma once
+#include <deque>
 #include "Window.h"
+#include "RenderBackend.h"
 
 namespace UI {
 
 class Screen : public Window {
 public:
-    using Window::Window;
+    // Screen(): our window is created once the backend is initialized, by assigning a
+    // Window backed by the backend's surfaceScreen()
+    Screen(RenderBackendPtr backend) : Window(Uninit), _backend(backend) {
+        assert(_backend);
+    }
     
-    Point origin() const override {
-        return { getbegx((WINDOW*)(*this)), getbegy((WINDOW*)(*this)) };
+    ~Screen() {
+        // Release our surface before _backend, which created it
+        Window::operator =(Window(Uninit));
     }
+    
+    RenderBackend& backend() const { return *_backend; }
+    
+    Point origin() const override { return windowOrigin(); }
     bool origin(const Point& x) override { return false; } // Ignore attempts to set screen origin
     
-    Size size() const override {
-        return { getmaxx((WINDOW*)(*this)), getmaxy((WINDOW*)(*this)) };
-    }
+    Size size() const override { return windowSize(); }
     bool size(const Size& x) override { return false; } // Ignore attempts to set screen size
     
     Size windowSize() const override { return Window::windowSize(); }
@@ -161,6 +170,8 @@ public:
 //    }
     
     virtual void refresh() {
+        _refreshTime = std::chrono::steady_clock::now();
+        
         GraphicsState gstate = graphicsStateCalc(*this);
         gstate.orderPanels = _orderPanelsNeeded;
         
@@ -179,9 +190,7 @@ public:
         }
         
         draw(gstate);
-        ::update_panels();
-        ::refresh();
-        _cursorDraw();
+        _backend->present(_cursorStateScreen());
         
         _orderPanelsNeeded = false;
     }
@@ -189,49 +198,120 @@ public:
     virtual Event eventNext(Deadline deadline=Forever) {
         using namespace std::chrono;
         
-        refresh();
+        // Render before waiting for the next event. If we rendered less than a frame interval
+        // ago, we're in the middle of a burst of events (eg mouse motion during a drag), so
+        // only render if the burst doesn't deliver another event before the frame interval
+        // elapses. This caps our frame rate, so that over slow links (eg SSH), rendering
+        // doesn't fall behind the events that it's rendering.
+        const steady_clock::time_point frameTime = _refreshTime+_frameInterval;
+        const bool frameDue = steady_clock::now() >= frameTime;
+        if (!frameDue && _eventsPending.empty()) {
+            Deadline peekDeadline = frameTime;
+            if (deadline!=Forever && deadline!=Once) peekDeadline = std::min(peekDeadline, deadline);
+            const Event ev = _eventRead(peekDeadline);
+            if (ev) _eventsPending.push_front(ev);
+        }
+        
+        if (frameDue || _eventsPending.empty()) refresh();
+        
+        Event ev = _eventRead(deadline);
+        if (!ev) return {}; // Deadline passed
+        
+        // Only set _eventCurrent once we're sure that we're returning the event
+        ev.id = _eventCurrent.id+1;
+        _eventCurrent = ev;
+        return ev;
+    }
+    
+    virtual Event eventNext(std::chrono::milliseconds timeout) {
+        return eventNext(std::chrono::steady_clock::now()+timeout);
+    }
+    
+    virtual const Event& eventCurrent() const {
+        return _eventCurrent;
+    }
+    
+    // eventSince() returns whether events have occurred since the given event
+    virtual bool eventSince(const Event& ev) {
+        return _eventCurrent.id != ev.id;
+    }
+    
+    virtual GraphicsState graphicsStateCalc(View& target) {
+        return _graphicsStateCalc(target, {.screen=this}, *this);
+    }
+    
+    // frameInterval(): the minimum interval between frames rendered by eventNext()
+    virtual std::chrono::steady_clock::duration frameInterval() const { return _frameInterval; }
+    virtual void frameInterval(std::chrono::steady_clock::duration x) { _frameInterval = x; }
+    
+    virtual bool orderPanelsNeeded() { return _orderPanelsNeeded; }
+    virtual void orderPanelsNeeded(bool x) { _orderPanelsNeeded = x; }
+    
+private:
+    // _cursorStateScreen(): returns the cursor state to present, which hides the cursor
+    // if it's offscreen
+    CursorState _cursorStateScreen() const {
+        if (!hitTest(_cursorState.origin)) return {};
+        return _cursorState;
+    }
+    
+    static bool _MouseMoved(const Event& ev) {
+        return ev.type==Event::Type::Mouse && (ev.mouse.bstate & REPORT_MOUSE_POSITION);
+    }
+    
+    // _eventRead(): returns the next event, or an empty event if `deadline` passes first
+    // Mouse-moved events that are already queued behind the one that was read are dropped
+    // in favor of the latest one, so that mouse motion never builds up a backlog.
+    Event _eventRead(Deadline deadline) {
+        Event ev = _eventReadRaw(deadline);
+        while (_MouseMoved(ev)) {
+            const Event next = _eventReadRaw(Poll);
+            if (!next) break;
+            if (!_MouseMoved(next) || next.mouse.bstate!=ev.mouse.bstate) {
+                _eventsPending.push_front(next);
+                break;
+            }
+            ev = next;
+        }
+        return ev;
+    }
+    
+    // _eventReadRaw(): returns the next event, or an empty event if `deadline` passes first
+    Event _eventReadRaw(Deadline deadline) {
+        using namespace std::chrono;
+        
+        if (!_eventsPending.empty()) {
+            const Event ev = _eventsPending.front();
+            _eventsPending.pop_front();
+            return ev;
+        }
         
         // Wait for another event
         for (;;) {
             // Set the appropriate timeout according to the deadline
-            {
-                int ms = 0;
-                if (deadline==Forever || deadline==Once) ms = -1;
-                else if (deadline == Poll) ms = 0;
-                else {
-                    ms = (int)std::max((intmax_t)0, (intmax_t)duration_cast<milliseconds>(deadline-steady_clock::now()).count());
-                }
-                wtimeout(*this, ms);
+            int ms = 0;
+            if (deadline==Forever || deadline==Once) ms = -1;
+            else if (deadline == Poll) ms = 0;
+            else {
+                // Round up, otherwise we'd wake before the deadline
+                ms = (int)std::max((intmax_t)0, (intmax_t)ceil<milliseconds>(deadline-steady_clock::now()).count());
             }
             
-            int ch = ::wgetch(*this);
-            if (ch == ERR) {
-                // We got an error:
+            Event ev = _backend->eventRead(ms);
+            if (!ev) {
+                // We didn't get an event:
                 //   if timeout isn't enabled, wait for an event again
                 //   if timeout is enabled and it's expired, return an empty event
                 if (deadline==Forever || deadline==Once) continue;
                 // >= and not > so that deadline=now() can be given and we're
                 // guaranteed to perform a single iteration
                 if (steady_clock::now() >= deadline) return {};
+                // Otherwise we woke before the deadline, so wait again
+                continue;
             }
             
-            Event ev = {
-                .id = _eventCurrent.id+1,
-                .type = (Event::Type)ch,
-                .time = steady_clock::now(),
-            };
+            ev.time = steady_clock::now();
             switch (ev.type) {
-            case Event::Type::Mouse: {
-                MEVENT mouse = {};
-                int ir = ::getmouse(&mouse);
-                if (ir != OK) continue;
-                ev.mouse = {
-                    .origin = {mouse.x, mouse.y},
-                    .bstate = mouse.bstate,
-                };
-                break;
-            }
-            
             case Event::Type::WindowResize: {
                 throw WindowResize();
             }
@@ -245,50 +325,17 @@ public:
                 break;
             }}
             
-            // Only set _eventCurrent once we're sure that we're returning the event
-            _eventCurrent = ev;
             return ev;
         }
     }
     
-    virtual Event eventNext(std::chrono::milliseconds timeout) {
-        return eventNext(std::chrono::steady_clock::now()+timeout);
-    }
-    
-    virtual const Event& eventCurrent() const {
-        return _eventCurrent;
-    }
-    
-    // eventSince() returns whether events have occurred since the given event
-    virtual bool eventSince(const Event& ev) {
-        return _eventCurrent.id != ev.id;
-    }
-    
-    virtual GraphicsState graphicsStateCalc(View& target) {
-        return _graphicsStateCalc(target, {.screen=this}, *this);
-    }
-    
-    virtual bool orderPanelsNeeded() { return _orderPanelsNeeded; }
-    virtual void orderPanelsNeeded(bool x) { _orderPanelsNeeded = x; }
-    
-private:
-    void _cursorDraw() {
-        if (hitTest(_cursorState.origin)) {
-            ::curs_set(_cursorState.visible);
-            ::move(_cursorState.origin.y, _cursorState.origin.x);
-            
-        } else {
-            ::curs_set(false);
-        }
-    }
-    
     GraphicsState _graphicsStateCalc(View& target, GraphicsState gstate, View& view) const {
         gstate = view.convert(gstate);
         if (&view == &target) return gstate;
         
         auto it = view.subviewsBegin();
         for (;;) {
-            ViewPtr subview = view.subviewsNext(it);
+            View* subview = view.subviewsNext(it);
             if (!subview) return {};
             GraphicsState gsubview = _graphicsStateCalc(target, gstate, *subview);
             if (gsubview) return gsubview;
@@ -296,7 +343,13 @@ private:
     }
     
     _GraphicsStateSwapper _gstate = View::GStatePush({.screen=this});
+    static constexpr std::chrono::milliseconds _FrameIntervalDefault = std::chrono::milliseconds(1000/60);
+    
     Event _eventCurrent;
+    std::deque<Event> _eventsPending;
+    std::chrono::steady_clock::time_point _refreshTime;
+    std::chrono::steady_clock::duration _frameInterval = _FrameIntervalDefault;
+    RenderBackendPtr _backend;
     ColorPalette _colors;
     CursorState _cursorState;
     bool _orderPanelsNeeded = false;
@@ -22,15 +22,7 @@ public:
                 Point p = {1, button0->frame().b()};
                 int len = width-2;
                 
-                constexpr cchar_t Chars = { 0, L"╍" };
-//                cchar_t c = {};
-//                const wchar_t chars[] = L"╍";
-//                static_assert(sizeof(chars) <= sizeof(c.chars));
-//                // GCC has a weird bug where we can't initialize `c` with designated-initializer
-//                // syntax, without using extra braces that Clang can't compile. So just memcpy it.
-//                memcpy(c.chars, chars, sizeof(chars));
-                
-                mvwhline_set(*this, p.y, p.x, &Chars, len);
+                drawLineHoriz(p, len, L'╍');
             }
         }
     }
@@ -22,7 +22,7 @@ public:
         
         if (_focusedAndEnabled()) {
             const int alignOff = _alignOff();
-            const size_t cursorOff = UTF8::Len(_left(), _cursor());
+            const size_t cursorOff = UTF8::Width(_view(_left()).substr(0, _cursor()-_left()));
             cursorState({.visible=true, .origin={alignOff+(int)cursorOff, 0}});
         }
     }
@@ -34,12 +34,8 @@ public:
             drawLineHoriz({}, size().x, ' ');
         }
         
-        // Print as many codepoints as will fit our width
-        const int width = size().x;
-        auto left = _left();
-        auto right = UTF8::NextN(left, _value.end(), width);
-        
-        std::string substr(left, right);
+        // Print as much of our value as will fit our width
+        const std::string substr = UTF8::TruncateTail(_view(_left()), size().x);
         drawText({_alignOff(), 0}, substr.c_str());
     }
     
@@ -125,7 +121,7 @@ private:
     
     std::string::iterator _leftMin() { return _value.begin(); }
     std::string::iterator _leftMax() {
-        return UTF8::NextN(_value.end(), _value.begin(), -size().x);
+        return _value.begin() + UTF8::WidthSuffixOff(_value, size().x);
     }
     
     std::string::iterator _cursor() {
@@ -135,7 +131,12 @@ private:
     
     std::string::iterator _cursorMin() { return _left(); }
     std::string::iterator _cursorMax() {
-        return UTF8::NextN(_cursorMin(), _value.end(), size().x);
+        return _cursorMin() + UTF8::WidthPrefixLen(_view(_cursorMin()), size().x);
+    }
+    
+    // _view(): returns our value starting at `it`
+    std::string_view _view(std::string::iterator it) const {
+        return std::string_view(_value).substr(it-_value.begin());
     }
     
     ssize_t _offLeftMin() { return std::distance(_value.begin(), _leftMin()); }
@@ -162,9 +163,8 @@ private:
                 
                 if ((ev.mouseDown() && hit) || _drag) {
                     // Update the cursor position to the clicked point
-                    int offX = ev.mouse.origin.x-_alignOff();
-                    auto offIt = UTF8::NextN(_left(), _value.end(), offX);
-                    _offCursor = std::distance(_value.begin(), offIt);
+                    const int offX = std::max(0, ev.mouse.origin.x-_alignOff());
+                    _offCursor = _offLeft + UTF8::WidthPrefixLen(_view(_left()), offX);
                 }
                 
                 if (ev.mouseDown() && hit && !_focused) {
@@ -211,7 +211,7 @@ private:
     }
     
     int _alignOff() const {
-        const size_t len = UTF8::Len(_value);
+        const size_t len = UTF8::Width(_value);
         const int width = size().x;
         switch (_align) {
         case Align::Left:
@@ -281,14 +281,15 @@ private:
             auto cursor = _cursor();
             if (cursor == _value.end()) return;
             
-            // If the cursor's at the display-end, shift view right
-            if (cursor == _cursorMax()) {
+            auto it = UTF8::Next(cursor, _value.end());
+            _offCursor = std::distance(_value.begin(), it);
+            
+            // If the cursor moved past the display-end, shift view right until it's visible.
+            // This can take more than one codepoint when the cursor moved past a wide one.
+            while (_cursor() > _cursorMax()) {
                 auto left = UTF8::Next(_left(), _value.end());
                 _offLeft = std::distance(_value.begin(), left);
             }
-            
-            auto it = UTF8::Next(cursor, _value.end());
-            _offCursor = std::distance(_value.begin(), it);
         
         } else if (ev.type == Event::Type::KeyUp) {
             _offLeft = _offLeftMin();
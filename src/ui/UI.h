@@ -1,5 +1,7 @@
 #pragma once
 #include <list>
+#include <vector>
+#include <array>
 #include <chrono>
 
 #define NCURSES_WIDECHAR 1
@@ -169,6 +171,9 @@ struct GraphicsState {
 //    Window* finalWindow = nullptr;
     Point originWindow; // For drawing purposes (relative to nearest window)
     Point originScreen; // For event purposes (relative to screen)
+    // Regions of the window that were erased/overwritten during the current draw
+    // pass (relative to nearest window); views overlapping these are redrawn
+    std::vector<Rect>* damage = nullptr;
     bool erased = false;
     bool orderPanels = false;
 };
@@ -219,6 +224,16 @@ inline constexpr bool Empty(const Rect& x) {
     return x.size.x==0 || x.size.y==0;
 }
 
+// BorderRects(): returns the 1-cell-thick top/bottom/left/right edges of `r`
+inline constexpr std::array<Rect,4> BorderRects(const Rect& r) {
+    return {
+        Rect{r.origin, {r.size.x, 1}},
+        Rect{{r.origin.x, r.origin.y+r.size.y-1}, {r.size.x, 1}},
+        Rect{r.origin, {1, r.size.y}},
+        Rect{{r.origin.x+r.size.x-1, r.origin.y}, {1, r.size.y}},
+    };
+}
+
 inline constexpr bool HitTest(const Rect& r, const Point& p, Edges inset={}) {
     return !Empty(Intersection(Inset(r, inset), {p, {1,1}}));
 }
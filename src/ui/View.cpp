@@ -58,8 +58,13 @@ void View::track(Deadline deadline) {
 }
 
 
-WINDOW* View::_window() const {
-    return (WINDOW*)window();
+RenderBackend& View::Backend() {
+    assert(_GState.screen);
+    return _GState.screen->backend();
+}
+
+RenderBackend::Surface& View::_surface() const {
+    return window().surface();
 }
 
 } // namespace UI
@@ -4,6 +4,8 @@
 #include <cassert>
 #include "UI.h"
 #include "Color.h"
+#include "RenderBackend.h"
+#include "ViewArena.h"
 #include "lib/toastbox/Defer.h"
 
 namespace UI {
@@ -11,13 +13,17 @@ namespace UI {
 class Window;
 class Screen;
 
-class View {
+class View : public std::enable_shared_from_this<View> {
 public:
     using Ptr = std::shared_ptr<View>;
     using WeakPtr = std::weak_ptr<View>;
     
-    using Views = std::list<WeakPtr>;
-    using ViewsIter = Views::iterator;
+    // Views: a view's subviews, in back-to-front order
+    // Subviews are owned elsewhere (usually by their superview's members). A subview
+    // that's destroyed nulls its own entry, which is pruned by the next layout pass, so
+    // the remaining pointers are always valid.
+    using Views = std::vector<View*>;
+    using ViewsIter = size_t;
     
     using Deadline = std::chrono::steady_clock::time_point;
     static constexpr Deadline Forever = std::chrono::steady_clock::time_point::max();
@@ -60,15 +66,14 @@ public:
     class Attr {
     public:
         Attr() {}
-        Attr(WINDOW* window, attr_t attr) : _s({.window=window, .attr=attr}) {
-            assert(window);
+        Attr(RenderBackend::Surface& surface, attr_t attr) : _s({.surface=&surface, .attr=attr}) {
 //            if (rand() % 2) {
 //                wattron(_s.window, WA_REVERSE);
 //            } else {
 //                wattroff(_s.window, WA_REVERSE);
 //            }
             // MARK: - Drawing
-            wattr_on(_s.window, _s.attr, nullptr);
+            _s.surface->attrOn(_s.attr);
         }
         
         Attr(const Attr& x) = delete;
@@ -76,14 +81,14 @@ public:
         Attr& operator =(Attr&& x) { std::swap(_s, x._s); return *this; }
         
         ~Attr() {
-            if (_s.window) {
-                wattr_off(_s.window, _s.attr, nullptr);
+            if (_s.surface) {
+                _s.surface->attrOff(_s.attr);
             }
         }
     
     private:
         struct {
-            WINDOW* window = nullptr;
+            RenderBackend::Surface* surface = nullptr;
             attr_t attr = 0;
         } _s;
     };
@@ -97,6 +102,9 @@ public:
         return _GraphicsStateSwapper(_GState, x);
     }
     
+    // Backend(): the render backend of the current screen
+    static RenderBackend& Backend();
+    
     static Point SubviewConvert(const View& dst, const Point& p) { return p-dst.origin(); }
     static Rect SubviewConvert(const View& dst, const Rect& r) { return { SubviewConvert(dst, r.origin), r.size }; }
     static Event SubviewConvert(const View& dst, const Event& ev) {
@@ -143,7 +151,25 @@ public:
 //        return r;
 //    }
     
-    virtual ~View() = default;
+    virtual ~View() {
+        // Leave a hole in our superview's subviews, which it prunes during its next layout
+        // pass, so that we don't disturb a traversal that's in progress
+        if (_tree.superview) {
+            _tree.superview->_tree.subviews[_tree.superviewIdx] = nullptr;
+            _tree.superview->_tree.holes = true;
+        }
+        
+        // Our subviews can outlive us
+        for (View* subview : _tree.subviews) {
+            if (subview) subview->_tree.superview = nullptr;
+        }
+    }
+    
+    // Create(): creates a view, allocating it from the view arena
+    template <typename T, typename ...T_Args>
+    static std::shared_ptr<T> Create(T_Args&&... args) {
+        return std::allocate_shared<T>(ViewArena::Allocator<T>(), std::forward<T_Args>(args)...);
+    }
     
     virtual bool hitTest(const Point& p) const {
         return HitTest(bounds(), p, _hitTestInset);
@@ -196,7 +222,7 @@ public:
 //    }
     
     // MARK: - Attributes
-    virtual Attr attr(attr_t attr) const { return Attr(_window(), attr); }
+    virtual Attr attr(attr_t attr) const { return Attr(_surface(), attr); }
     
     // MARK: - Drawing
     virtual void drawRect() const {
@@ -209,45 +235,48 @@ public:
         const int y1 = r.origin.y;
         const int x2 = r.origin.x+r.size.x-1;
         const int y2 = r.origin.y+r.size.y-1;
-        mvwhline(_window(), y1, x1, 0, r.size.x);
-        mvwhline(_window(), y2, x1, 0, r.size.x);
-        mvwvline(_window(), y1, x1, 0, r.size.y);
-        mvwvline(_window(), y1, x2, 0, r.size.y);
-        mvwaddch(_window(), y1, x1, ACS_ULCORNER);
-        mvwaddch(_window(), y2, x1, ACS_LLCORNER);
-        mvwaddch(_window(), y1, x2, ACS_URCORNER);
-        mvwaddch(_window(), y2, x2, ACS_LRCORNER);
+        RenderBackend::Surface& s = _surface();
+        s.lineHorizDraw({x1,y1}, r.size.x);
+        s.lineHorizDraw({x1,y2}, r.size.x);
+        s.lineVertDraw({x1,y1}, r.size.y);
+        s.lineVertDraw({x2,y1}, r.size.y);
+        s.glyphDraw({x1,y1}, Glyph::CornerUL);
+        s.glyphDraw({x1,y2}, Glyph::CornerLL);
+        s.glyphDraw({x2,y1}, Glyph::CornerUR);
+        s.glyphDraw({x2,y2}, Glyph::CornerLR);
+    }
+    
+    virtual void drawLineHoriz(const Point& p, int len, wchar_t ch=0) const {
+        _surface().lineHorizDraw(_GState.originWindow+p, len, ch);
     }
     
-    virtual void drawLineHoriz(const Point& p, int len, chtype ch=0) const {
-        const Point off = _GState.originWindow;
-        mvwhline(_window(), off.y+p.y, off.x+p.x, ch, len);
+    virtual void drawLineVert(const Point& p, int len, wchar_t ch=0) const {
+        _surface().lineVertDraw(_GState.originWindow+p, len, ch);
     }
     
-    virtual void drawLineVert(const Point& p, int len, chtype ch=0) const {
-        const Point off = _GState.originWindow;
-        mvwvline(_window(), off.y+p.y, off.x+p.x, ch, len);
+    virtual void drawGlyph(const Point& p, Glyph glyph) const {
+        _surface().glyphDraw(_GState.originWindow+p, glyph);
     }
     
     virtual void drawText(const Point& p, const char* txt) const {
-        const Point off = _GState.originWindow;
-        mvwprintw(_window(), off.y+p.y, off.x+p.x, "%s", txt);
+        _surface().textDraw(_GState.originWindow+p, txt);
     }
     
     virtual void drawText(const Point& p, int widthMax, const char* txt) const {
-        const Point off = _GState.originWindow;
         widthMax = std::max(0, widthMax);
         
-        std::string str = txt;
-        auto it = UTF8::NextN(str.begin(), str.end(), widthMax);
-        str.resize(std::distance(str.begin(), it));
-        mvwprintw(_window(), off.y+p.y, off.x+p.x, "%s", str.c_str());
+        const std::string str = UTF8::TruncateTail(txt, widthMax);
+        _surface().textDraw(_GState.originWindow+p, str);
     }
     
     template <typename ...T_Args>
     void drawText(const Point& p, const char* fmt, T_Args&&... args) const {
-        const Point off = _GState.originWindow;
-        mvwprintw(_window(), off.y+p.y, off.x+p.x, fmt, std::forward<T_Args>(args)...);
+        const int len = snprintf(nullptr, 0, fmt, args...);
+        if (len <= 0) return;
+        std::string str(len+1, 0);
+        snprintf(str.data(), str.size(), fmt, args...);
+        str.resize(len);
+        _surface().textDraw(_GState.originWindow+p, str);
     }
     
     // MARK: - Accessors
@@ -298,14 +327,22 @@ public:
     // MARK: - Erase
     virtual bool eraseNeeded() const { return _eraseNeeded; }
     virtual void eraseNeeded(bool x) { _eraseNeeded = x; }
-    virtual void erase() {
+    virtual void erase() { erase(bounds()); }
+    virtual void erase(const Rect& rect) {
         if (!_inhibitErase) {
 //            os_log(OS_LOG_DEFAULT, "VIEW ERASE");
-            const Size s = size();
-            for (int y=0; y<s.y; y++) drawLineHoriz({0,y}, s.x, ' ');
+            for (int y=rect.t(); y<rect.b(); y++) drawLineHoriz({rect.l(),y}, rect.w(), ' ');
         }
     }
     
+    // damage(): erases `rect` (in our coordinates) during the next draw pass, and redraws
+    // ourself and the views that overlap `rect`, leaving the rest of the screen untouched
+    virtual void damage(const Rect& rect) {
+        if (Empty(rect)) return;
+        _damage.push_back(rect);
+        drawNeeded(true);
+    }
+    
     // MARK: - Draw
     virtual bool drawNeeded() const { return _drawNeeded; }
     virtual void drawNeeded(bool x) { _drawNeeded = x; }
@@ -317,6 +354,8 @@ public:
         if (_borderColor) {
             Attr color = attr(*_borderColor);
             drawRect();
+            // Subviews that overlap our border need to be redrawn on top of it
+            for (const Rect& r : BorderRects(bounds())) _damageAdd(r);
         }
     }
     
@@ -361,13 +400,15 @@ public:
             layoutNeeded(false);
         }
         
+        _subviewsPrune();
+        
         auto subviewsId = _subviewsId;
         auto it = subviewsBegin();
         for (;;) {
             // Detect _subviews being modified while we're iterating
             assert(_subviewsId == subviewsId);
             
-            Ptr subview = subviewsNext(it);
+            View* subview = subviewsNext(it);
             if (!subview) break;
             subview->layout(subview->convert(gstate));
         }
@@ -412,11 +453,26 @@ public:
         
         // If the superview erased itself, then we don't need to erase ourself since we're
         // a subview of the superview, and therefore have already been erased
-        if (!erasedPrev && erased) erase();
+        if (!erasedPrev && erased) {
+            erase();
+            _damageAdd(bounds());
+        }
         eraseNeeded(false);
         
-        // Redraw the view if it says it needs it, or if this part of the view tree has been erased
-        if (drawNeeded() || gstate.erased) {
+        // Erase the regions that were damaged since the last draw pass (unnecessary if
+        // we were erased entirely)
+        if (!gstate.erased) {
+            for (const Rect& r : _damage) {
+                erase(r);
+                _damageAdd(r);
+            }
+        }
+        _damage.clear();
+        
+        // Redraw the view if it says it needs it, or if it overlaps a region that was erased
+        // or overwritten earlier in this draw pass. Views outside of the damaged regions are
+        // left alone.
+        if (drawNeeded() || gstate.erased || _damaged(bounds())) {
             drawBackground();
             draw();
             drawBorder();
@@ -429,7 +485,7 @@ public:
             // Detect _subviews being modified while we're iterating
             assert(_subviewsId == subviewsId);
             
-            Ptr subview = subviewsNext(it);
+            View* subview = subviewsNext(it);
             if (!subview) break;
             subview->draw(subview->convert(gstate));
         }
@@ -442,9 +498,15 @@ public:
         auto gpushed = View::GStatePush(gstate);
         
         // We have to copy _subviews since we allow it to be modified while we're iterating over it
-        // within our handleEvent() callout
-        // TODO: optimize copying _subviews by using a stack array
-        Views subviews = _subviews;
+        // within our handleEvent() callout. The copy holds weak references, since handling an
+        // event can also destroy subviews (eg reloading a column destroys its CommitPanels).
+        // Unlike layout/draw this only happens once per event, so the copy is affordable.
+        std::vector<WeakPtr> subviews;
+        subviews.reserve(_tree.subviews.size());
+        for (View* subview : _tree.subviews) {
+            if (subview) subviews.push_back(subview->weak_from_this());
+        }
+        
         for (auto it=subviews.rbegin(); it!=subviews.rend(); it++) {
             Ptr subview = (*it).lock();
             if (!subview) continue;
@@ -479,56 +541,65 @@ public:
 //            if (sv) svs.push_back(sv);
 //        }
         
-        _subviews = {};
+        for (View* subview : _tree.subviews) {
+            if (subview) subview->_tree.superview = nullptr;
+        }
+        _tree.subviews.clear();
+        _tree.holes = false;
+        
         for (Ptr sv : x) subviewAdd(sv);
         _subviewsId++;
     }
     
     virtual ViewsIter subviewsBegin() {
-        return _subviews.begin();
+        return 0;
     }
     
     virtual ViewsIter subviewsEnd() {
-        return _subviews.end();
-    }
-    
-    virtual Ptr subviewsNext(ViewsIter& it) {
-        Ptr subview = nullptr;
-        while (it!=_subviews.end() && !subview) {
-            subview = (*it).lock();
-            if (!subview) {
-                // Prune and continue
-                it = _subviews.erase(it);
-            } else {
-                it++;
-            }
+        return _tree.subviews.size();
+    }
+    
+    // subviewsNext()/subviewsPrev(): returns the next/previous subview, skipping subviews
+    // that were destroyed, or nullptr when there are no more
+    // Neither allocates nor touches reference counts, since they're used for every view
+    // on every frame.
+    virtual View* subviewsNext(ViewsIter& it) {
+        while (it < _tree.subviews.size()) {
+            View* subview = _tree.subviews[it];
+            it++;
+            if (subview) return subview;
         }
-        return subview;
+        return nullptr;
     }
     
-    virtual Ptr subviewsPrev(ViewsIter& it) {
-        Ptr subview = nullptr;
-        while (it!=_subviews.begin() && !subview) {
+    virtual View* subviewsPrev(ViewsIter& it) {
+        while (it > 0) {
             it--;
-            subview = (*it).lock();
-            if (!subview) {
-                // Prune and continue
-                it = _subviews.erase(it);
-            }
+            View* subview = _tree.subviews[it];
+            if (subview) return subview;
         }
-        return subview;
+        return nullptr;
     }
     
     template <typename T, typename ...T_Args>
     std::shared_ptr<T> subviewCreate(T_Args&&... args) {
-        auto view = std::make_shared<T>(std::forward<T_Args>(args)...);
+        auto view = Create<T>(std::forward<T_Args>(args)...);
         subviewAdd(view);
         return view;
     }
     
     virtual void subviewAdd(Ptr view) {
         assert(view);
-        _subviews.push_back(view);
+        // A view only has one superview
+        if (view->_tree.superview) {
+            view->_tree.superview->_tree.subviews[view->_tree.superviewIdx] = nullptr;
+            view->_tree.superview->_tree.holes = true;
+        }
+        
+        _subviewsPrune();
+        view->_tree.superview = this;
+        view->_tree.superviewIdx = _tree.subviews.size();
+        _tree.subviews.push_back(view.get());
         _subviewsId++;
         view->addedToSuperview(*this);
         layoutNeeded(true);
@@ -583,6 +654,24 @@ protected:
     }
     
 protected:
+    // _damageAdd(): records that `rect` (in our coordinates) was erased or overwritten
+    // during the current draw pass
+    void _damageAdd(const Rect& rect) const {
+        assert(_GState.damage);
+        _GState.damage->push_back({_GState.originWindow+rect.origin, rect.size});
+    }
+    
+    // _damaged(): returns whether `rect` (in our coordinates) overlaps a region that was
+    // erased or overwritten during the current draw pass
+    bool _damaged(const Rect& rect) const {
+        assert(_GState.damage);
+        const Rect r = {_GState.originWindow+rect.origin, rect.size};
+        for (const Rect& d : *_GState.damage) {
+            if (!Empty(Intersection(d, r))) return true;
+        }
+        return false;
+    }
+    
     class _GraphicsStateSwapper {
     public:
         _GraphicsStateSwapper() {}
@@ -616,11 +705,40 @@ protected:
     };
     
 private:
-    WINDOW* _window() const;
+    RenderBackend::Surface& _surface() const;
+    
+    // _subviewsPrune(): removes the holes left in our subviews by destroyed subviews
+    // Shrinking a vector doesn't release its storage, so this doesn't allocate.
+    void _subviewsPrune() {
+        if (!_tree.holes) return;
+        size_t count = 0;
+        for (View* subview : _tree.subviews) {
+            if (!subview) continue;
+            subview->_tree.superviewIdx = count;
+            _tree.subviews[count] = subview;
+            count++;
+        }
+        _tree.subviews.resize(count);
+        _tree.holes = false;
+    }
     
     static inline GraphicsState _GState;
     
-    Views _subviews;
+    // _Tree: our position in the view hierarchy
+    // Copying a view copies its attributes but not its position in the hierarchy, since
+    // a view has at most one superview.
+    struct _Tree {
+        _Tree() {}
+        _Tree(const _Tree&) {}
+        _Tree& operator =(const _Tree&) { return *this; }
+        
+        View* superview = nullptr;
+        size_t superviewIdx = 0;
+        Views subviews;
+        bool holes = false;
+    };
+    
+    _Tree _tree;
     uint32_t _subviewsId = 0;
     Point _origin;
     Size _size;
@@ -633,6 +751,7 @@ private:
     bool _tracking = false;
     bool _trackStop = false;
     bool _inhibitErase = false;
+    std::vector<Rect> _damage;
     Edges _hitTestInset;
     std::optional<Color> _borderColor;
 };
@@ -0,0 +1,100 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <new>
+#include <algorithm>
+
+namespace UI {
+
+// ViewArena: allocates views (along with their shared_ptr control blocks) from slabs of
+// fixed-size slots, with a separate pool of slots for each allocation size
+// Freed slots are reused by later allocations of the same size, so rebuilding the view
+// tree (eg reloading a column's CommitPanels) doesn't hit the system allocator once
+// the slabs are large enough. Slots never move, so pointers to views are stable.
+// Not thread-safe: views are only created and destroyed on the UI thread.
+class ViewArena {
+public:
+    // Allocator: a std allocator that allocates from the shared arena, for use with
+    // std::allocate_shared()
+    template <typename T>
+    struct Allocator {
+        using value_type = T;
+        
+        Allocator() {}
+        template <typename U> Allocator(const Allocator<U>&) {}
+        
+        T* allocate(size_t n) {
+            static_assert(alignof(T) <= _Align);
+            if (n != 1) return (T*)::operator new(n*sizeof(T));
+            return (T*)Shared().alloc(sizeof(T));
+        }
+        
+        void deallocate(T* p, size_t n) {
+            if (n != 1) ::operator delete(p);
+            else Shared().free(p, sizeof(T));
+        }
+        
+        template <typename U> bool operator ==(const Allocator<U>&) const { return true; }
+        template <typename U> bool operator !=(const Allocator<U>&) const { return false; }
+    };
+    
+    static ViewArena& Shared() {
+        // Intentionally leaked, so that views that are destroyed during static destruction
+        // can still return their slots
+        static ViewArena* x = new ViewArena();
+        return *x;
+    }
+    
+    void* alloc(size_t len) {
+        _Pool& pool = _pool(len);
+        if (!pool.free) _poolGrow(pool);
+        _Slot* slot = pool.free;
+        pool.free = slot->next;
+        return slot;
+    }
+    
+    void free(void* p, size_t len) {
+        _Pool& pool = _pool(len);
+        _Slot* slot = (_Slot*)p;
+        slot->next = pool.free;
+        pool.free = slot;
+    }
+    
+private:
+    static constexpr size_t _Align = alignof(std::max_align_t);
+    static constexpr size_t _SlabSlotCount = 64;
+    
+    struct _Slot {
+        _Slot* next = nullptr;
+    };
+    
+    struct _Pool {
+        size_t slotLen = 0;
+        _Slot* free = nullptr;
+    };
+    
+    // _pool(): returns the pool for allocations of `len` bytes
+    // There are only a handful of view types, so a linear search is fastest.
+    _Pool& _pool(size_t len) {
+        const size_t slotLen = (std::max(len, sizeof(_Slot))+_Align-1) & ~(_Align-1);
+        for (_Pool& pool : _pools) {
+            if (pool.slotLen == slotLen) return pool;
+        }
+        return _pools.emplace_back(_Pool{.slotLen = slotLen});
+    }
+    
+    void _poolGrow(_Pool& pool) {
+        // operator new[] aligns to max_align_t, and slotLen is a multiple of it
+        std::unique_ptr<std::byte[]>& slab = _slabs.emplace_back(new std::byte[pool.slotLen*_SlabSlotCount]);
+        for (size_t i=_SlabSlotCount; i>0; i--) {
+            _Slot* slot = new (slab.get() + (i-1)*pool.slotLen) _Slot{ .next = pool.free };
+            pool.free = slot;
+        }
+    }
+    
+    std::vector<_Pool> _pools;
+    std::vector<std::unique_ptr<std::byte[]>> _slabs;
+};
+
+} // namespace UI
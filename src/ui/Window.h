@@ -3,6 +3,7 @@
 #include "UI.h"
 #include "UTF8.h"
 #include "View.h"
+#include "RenderBackend.h"
 #include "lib/toastbox/Bitfield.h"
 
 namespace UI {
@@ -13,14 +14,10 @@ public:
     static constexpr UninitType Uninit = {};
     Window(UninitType) {}
     
-    Window(WINDOW* win=nullptr) : _s{.win = win} {
-        if (!_s.win) {
-            _s.win = ::newwin(0, 0, 0, 0);
-            assert(_s.win);
+    Window(RenderBackend::SurfacePtr surface=nullptr) : _s{.surface = std::move(surface)} {
+        if (!_s.surface) {
+            _s.surface = View::Backend().surfaceCreate(RenderBackend::Surface::Type::Window);
         }
-        
-        ::keypad(_s.win, true);
-        ::meta(_s.win, true);
     }
     
     Window(const Window& x) = delete;
@@ -28,12 +25,6 @@ public:
         std::swap(_s, x._s);
     }
     
-    virtual ~Window() {
-        if (_s.win) {
-            ::delwin(_s.win);
-        }
-    }
-    
     Point origin() const override { return View::origin(); }
     
     bool origin(const Point& x) override {
@@ -60,21 +51,22 @@ public:
         x.window = this;
         x.originWindow = {};
         x.originScreen += origin();
+        x.damage = &_s.damage;
         x.erased = false;
         return x;
     }
     
-    virtual Point windowOrigin() const { return { getbegx(_s.win), getbegy(_s.win) }; }
+    virtual Point windowOrigin() const { return _s.surface ? _s.surface->origin() : Point{}; }
     virtual bool windowOrigin(const Point& p) {
         if (p == windowOrigin()) return false;
-        ::wmove(*this, p.y, p.x);
+        _s.surface->origin(p);
         return true;
     }
     
-    virtual Size windowSize() const { return { getmaxx(_s.win), getmaxy(_s.win) }; }
+    virtual Size windowSize() const { return _s.surface ? _s.surface->size() : Size{}; }
     virtual bool windowSize(const Size& s) {
         if (s == windowSize()) return false;
-        ::wresize(*this, s.y, s.x);
+        _s.surface->size(s);
         return true;
     }
     
@@ -88,17 +80,25 @@ public:
     
     void drawRect() const override {
         // For the case where we're drawing the window's border, we attempt
-        // to be more efficent than View's drawRect() by using ::box().
-        ::box(*this, 0, 0);
+        // to be more efficent than View's drawRect() by using the surface's borderDraw().
+        _s.surface->borderDraw();
     }
     
     void drawRect(const Rect& rect) const override {
         View::drawRect(rect);
     }
     
+    using View::erase;
     void erase() override {
         // Don't call super because View's implementation will be redundant
-        ::werase(*this);
+        _s.surface->erase();
+    }
+    
+    using View::draw;
+    void draw(GraphicsState gstate) override {
+        // Each draw pass starts without any damage
+        _s.damage.clear();
+        View::draw(gstate);
     }
     
     void layout(GraphicsState gstate) override {
@@ -137,12 +137,16 @@ public:
     
     virtual Window& operator =(Window&& x) { std::swap(_s, x._s); return *this; }
     
-    virtual operator WINDOW*() const { return _s.win; }
+    virtual RenderBackend::Surface& surface() const {
+        assert(_s.surface);
+        return *_s.surface;
+    }
     
 private:
     struct {
-        WINDOW* win = nullptr;
+        RenderBackend::SurfacePtr surface;
         Size sizePrev;
+        std::vector<Rect> damage;
     } _s;
 };
 